@@ -0,0 +1,30 @@
+/********************************************************************************
+*  File:  hidef.h  (host simulator version)
+*  Description: Stand-in for the CodeWarrior hidef.h when LAB1 is built on the
+*               host.  Maps the CPU intrinsics and HC12 keywords used by the
+*               lab sources onto the simulator in simHCS12.cpp.
+*********************************************************************************/
+
+#ifndef _H_HIDEF_
+#define _H_HIDEF_
+
+#include "simHCS12.h"
+
+#define EnableInterrupts   simCli()
+#define DisableInterrupts  simSei()
+#define SAVE_CCR(saved)    ((saved) = simCcr())
+
+/* HC12 compiler keywords */
+#define interrupt
+#define __far
+#define __near
+
+/* Far data pointers are flat host pointers: the paged Morse tables
+   (MORSE_TABLES_PAGED) are all on page 0x20, the first of MORSE_ROM */
+#define MORSE_PAGE_OF(p)       ((unsigned char)0x20)
+#define MORSE_WINDOW(type, p)  ((type)(p))
+
+/* asm("nop") in an idle loop becomes a skip to the next timer event */
+#define asm(insn)  simAsm(insn)
+
+#endif /* _H_HIDEF_ */
@@ -0,0 +1,84 @@
+/********************************************************************************
+*  File:  mc9s12dp512.h  (host simulator version)
+*  Description: Register names of the MC9S12DP512 used by LAB1, bound to the
+*               simulated register file in simHCS12.cpp instead of to the
+*               0x0000-0x03FF register block.
+*********************************************************************************/
+
+#ifndef _MC9S12DP512_H
+#define _MC9S12DP512_H
+
+#include "simHCS12.h"
+
+/*** ECT / TIM ***/
+extern SimReg8  TIOS, CFORC, OC7M, OC7D, TSCR1, TTOV, TCTL1, TCTL2, TCTL3, TCTL4;
+extern SimReg8  TIE, TSCR2, TFLG1, TFLG2;
+extern SimReg16 TCNT, TC0, TC1, TC2, TC3, TC4, TC5, TC6, TC7;
+
+#define TSCR1_TEN_MASK      128
+#define TSCR1_TSWAI_MASK    64
+#define TSCR1_TSFRZ_MASK    32
+#define TSCR1_TFFCA_MASK    16
+#define TSCR2_TOI_MASK      128
+#define TSCR2_TCRE_MASK     8
+#define TFLG2_TOF_MASK      128
+
+/*** PWM (only the concatenated 16-bit channel 6/7 is modelled) ***/
+extern SimReg8  PWME, PWMPOL, PWMCLK, PWMPRCLK, PWMCAE, PWMCTL, PWMSCLB;
+extern SimReg16 PWMCNT67, PWMPER67, PWMDTY67;
+
+#define PWME_PWME7_MASK     128
+#define PWMPOL_PPOL7_MASK   128
+#define PWMCLK_PCLK7_MASK   128
+#define PWMCAE_CAE7_MASK    128
+#define PWMCTL_CON67_MASK   128
+
+/*** Ports ***/
+extern SimReg8  PTT, DDRT, PTM, DDRM;
+
+/*** CRG and MEBI ***/
+extern SimReg8  SYNR, REFDV, CRGFLG, CLKSEL, PLLCTL, MODE, MISC;
+extern SimReg8  PPAGE;                 // program page, the 0x8000-0xBFFF window
+
+#define CRGFLG_LOCK_MASK    8
+#define CLKSEL_PLLSEL_MASK  128
+
+/*** ECT modulus down-counter ***/
+extern SimReg8  MCCTL;
+extern SimReg16 MCCNT;
+
+#define MCCTL_MODMC_MASK    64
+#define MCCTL_MCEN_MASK     4
+
+/*** SCI0 (transmitter only; a character goes out as soon as it is written) ***/
+extern SimReg8  SCI0CR1, SCI0CR2, SCI0SR1, SCI0DRL;
+extern SimReg16 SCI0BD;
+
+#define SCI0CR2_TE_MASK     8
+#define SCI0SR1_TDRE_MASK   128
+#define SCI0SR1_TC_MASK     64
+
+/*** ATD0 (8-bit results; every channel reads the one analog input) ***/
+extern SimReg8  ATD0CTL2, ATD0CTL3, ATD0CTL4, ATD0CTL5, ATD0STAT0, ATD0DR0H;
+
+#define ATD0CTL2_ADPU_MASK  128
+#define ATD0CTL2_AFFC_MASK  64
+#define ATD0CTL3_S1C_MASK   8
+#define ATD0CTL4_SRES8_MASK 128
+#define ATD0STAT0_SCF_MASK  128
+
+/*** Interrupt module ***/
+extern SimReg8  HPRIO;
+
+/*** Interrupt vector numbers (only used as interrupt keywords on the target) ***/
+#define VectorNumber_Vtimch7
+#define VectorNumber_Vtimch6
+#define VectorNumber_Vtimch5
+#define VectorNumber_Vtimch4
+#define VectorNumber_Vtimch3
+#define VectorNumber_Vtimch2
+#define VectorNumber_Vtimch1
+#define VectorNumber_Vtimch0
+#define VectorNumber_Vtimovf
+
+#endif /* _MC9S12DP512_H */
@@ -0,0 +1,896 @@
+/********************************************************************************
+*  File:  simHCS12.cpp
+*  Description: Event-driven model of the MC9S12DP512 timer, ports and CRG
+*               used to run the LAB1 sources on a Linux host.
+*
+*       The 16-bit counter is advanced in whole prescaler ticks.  Instead of
+*       stepping every tick, the model computes the bus cycle of the next
+*       output-compare match or scripted button edge and jumps straight to
+*       it, so a multi-second message simulates in well under a millisecond.
+*********************************************************************************/
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "simHCS12.h"
+#include "mc9s12dp512.h"
+
+// Bits of the real registers the model reacts to
+#define TSCR1_TEN      0x80
+#define TSCR2_TOI      0x80
+#define TSCR2_PR_MASK  0x07
+#define TFLG2_TOF      0x80
+#define CRGFLG_LOCK    0x08
+#define CLKSEL_PLLSEL  0x80
+#define PLLCTL_PLLON   0x40
+#define SPEAKER_PIN    0x08      // PT3
+#define PWM_CH7        0x80
+#define MCCTL_MODMC    0x40
+#define MCCTL_MCEN     0x04
+#define MCCTL_MCPR     0x03
+#define SCI_TE         0x08
+#define SCI_TDRE_TC    0xC0
+#define ATD_ADPU       0x80
+#define ATD_AFFC       0x40
+#define ATD_SCF        0x80
+#define ATD_PRS_MASK   0x1F
+#define ATD_CONV_CLOCKS  14      // 8-bit: 2 transfer + 2 sample + 10 conversion
+
+struct SimInput
+  {
+  double        ms;
+  int           channel;
+  unsigned char level;
+  };
+
+// ---------- Register objects seen by the lab sources ----------
+SimReg8  TIOS(SIM_TIOS), CFORC(SIM_CFORC), OC7M(SIM_OC7M), OC7D(SIM_OC7D);
+SimReg8  TSCR1(SIM_TSCR1), TTOV(SIM_TTOV), TCTL1(SIM_TCTL1), TCTL2(SIM_TCTL2);
+SimReg8  TCTL3(SIM_TCTL3), TCTL4(SIM_TCTL4), TIE(SIM_TIE), TSCR2(SIM_TSCR2);
+SimReg8  TFLG1(SIM_TFLG1), TFLG2(SIM_TFLG2);
+SimReg16 TCNT(SIM_TCNT), TC0(SIM_TC0), TC1(SIM_TC1), TC2(SIM_TC2), TC3(SIM_TC3);
+SimReg16 TC4(SIM_TC4), TC5(SIM_TC5), TC6(SIM_TC6), TC7(SIM_TC7);
+SimReg8  PWME(SIM_PWME), PWMPOL(SIM_PWMPOL), PWMCLK(SIM_PWMCLK), PWMPRCLK(SIM_PWMPRCLK);
+SimReg8  PWMCAE(SIM_PWMCAE), PWMCTL(SIM_PWMCTL), PWMSCLB(SIM_PWMSCLB);
+SimReg16 PWMCNT67(SIM_PWMCNT67), PWMPER67(SIM_PWMPER67), PWMDTY67(SIM_PWMDTY67);
+SimReg8  PTT(SIM_PTT), DDRT(SIM_DDRT), PTM(SIM_PTM), DDRM(SIM_DDRM);
+SimReg8  SYNR(SIM_SYNR), REFDV(SIM_REFDV), CRGFLG(SIM_CRGFLG), CLKSEL(SIM_CLKSEL);
+SimReg8  PLLCTL(SIM_PLLCTL), MODE(SIM_MODE), MISC(SIM_MISC), PPAGE(SIM_PPAGE);
+SimReg8  MCCTL(SIM_MCCTL);
+SimReg16 MCCNT(SIM_MCCNT);
+SimReg8  SCI0CR1(SIM_SCI0CR1), SCI0CR2(SIM_SCI0CR2), SCI0SR1(SIM_SCI0SR1), SCI0DRL(SIM_SCI0DRL);
+SimReg16 SCI0BD(SIM_SCI0BD);
+SimReg8  ATD0CTL2(SIM_ATD0CTL2), ATD0CTL3(SIM_ATD0CTL3), ATD0CTL4(SIM_ATD0CTL4);
+SimReg8  ATD0CTL5(SIM_ATD0CTL5), ATD0STAT0(SIM_ATD0STAT0), ATD0DR0H(SIM_ATD0DR0H);
+SimReg8  HPRIO(SIM_HPRIO);
+
+// ---------- Model state ----------
+static unsigned char  reg8[SIM_NUM_REG8];
+static unsigned short tc[8];
+static unsigned short tcnt;
+static unsigned int   tickPhase;          // bus cycles into the current prescaler tick
+static unsigned char  pins;               // PT7:0 pin levels
+static unsigned short pwmPer, pwmDty;     // period/duty latched at the last period start
+static unsigned short pwmPerReg, pwmDtyReg;
+static unsigned int   pwmCount;           // PWMCNT67
+static unsigned int   pwmPhase;           // bus cycles into the current PWM clock
+static unsigned char  pwmOut;             // PP7 level
+static unsigned short mcLoad;             // modulus down-counter load register
+static uint64_t       mcStart;            // bus cycle the counter was last loaded at
+static unsigned short sciBaud;
+static double       (*analogIn)(double ms);
+static uint64_t       atdDone;            // bus cycle the conversion in progress ends
+static unsigned char  atdNext;            // and its result
+static unsigned char  iBit;               // CCR I bit
+static unsigned char  inIsr;
+static uint64_t       now;                // bus cycles since reset
+static double         nowMs;              // target time since reset
+static double         oscillatorHz;
+static double         pllLockUs;          // PLL lock time from PLLON, < 0 never locks
+static double         pllLockMs;          // target time the PLL locks at
+static double         bounceMs;           // contact bounce after each button edge
+static int            bounceGlitches;     // and its number of pulses back to the old level
+static double         limitMs;
+static unsigned int   isrLatency;         // models masked sections / competing ISRs
+static jmp_buf        simExit;
+
+static SimIsr         vectors[SIM_NUM_VECTORS];
+static unsigned long  isrCount[SIM_NUM_VECTORS];
+static uint64_t       isrCycles[SIM_NUM_VECTORS];
+static unsigned int   isrWork[SIM_NUM_VECTORS];
+static uint64_t       workOwed;           // isrWork of the ISR in service, not charged yet
+static uint64_t       flagSince[SIM_NUM_VECTORS];
+static SimWait        isrWait[SIM_NUM_VECTORS];
+static SimWait        wakeLatency;
+static uint64_t       waiCycles, spinCycles;
+static int            waiStacked;         // woken from WAI: the next entry doesn't stack
+
+static std::vector<SimInput> inputs;
+static size_t                nextInput;
+static std::vector<SimEdge>  ledLog;
+static std::vector<SimEdge>  speakerLog;
+static std::string           sciOutput;
+
+// ---------- Clocks ----------
+
+double simBusHz(void)
+  {
+  // ECLK = OSCCLK * (SYNR+1)/(REFDV+1) with the PLL selected, OSCCLK/2 without
+  if (reg8[SIM_CLKSEL] & CLKSEL_PLLSEL)
+    return oscillatorHz * ((reg8[SIM_SYNR] & 0x3F) + 1) / ((reg8[SIM_REFDV] & 0x0F) + 1);
+  return oscillatorHz / 2;
+  }
+
+static unsigned int prescale(void)
+  {
+  return 1u << (reg8[SIM_TSCR2] & TSCR2_PR_MASK);
+  }
+
+// Bus cycles per PWM clock of channel 7: clock B, or SB = B/(2*PWMSCLB)
+static unsigned int pwmClock(void)
+  {
+  unsigned int b = 1u << ((reg8[SIM_PWMPRCLK] >> 4) & 0x07);
+  unsigned int scl = reg8[SIM_PWMSCLB] ? reg8[SIM_PWMSCLB] : 256;
+
+  return (reg8[SIM_PWMCLK] & PWM_CH7) ? b * 2 * scl : b;
+  }
+
+static int pwmRunning(void)
+  {
+  return (reg8[SIM_PWME] & PWM_CH7) && pwmPer != 0;
+  }
+
+static int timerRunning(void)
+  {
+  return (reg8[SIM_TSCR1] & TSCR1_TEN) != 0;
+  }
+
+// MCCNT: counts down from the load value at ECLK / 1, 4, 8 or 16, reloads
+// in modulus mode, stops at 0 otherwise. Never raises an interrupt here.
+static unsigned short modulusCount(void)
+  {
+  static const unsigned int divider[4] = { 1, 4, 8, 16 };
+  uint64_t elapsed;
+
+  if (!(reg8[SIM_MCCTL] & MCCTL_MCEN))
+    return mcLoad;
+  elapsed = (now - mcStart) / divider[reg8[SIM_MCCTL] & MCCTL_MCPR];
+  if (reg8[SIM_MCCTL] & MCCTL_MODMC)
+    return (unsigned short)(mcLoad - elapsed % ((uint64_t)mcLoad + 1));
+  return elapsed >= mcLoad ? 0 : (unsigned short)(mcLoad - elapsed);
+  }
+
+// ---------- Event search ----------
+
+// Bus cycles from now until TCNT next becomes value
+static uint64_t cyclesUntilCount(unsigned short value)
+  {
+  uint64_t ticks = (unsigned short)(value - tcnt);
+  if (ticks == 0)
+    ticks = 0x10000;
+  return (prescale() - tickPhase) + (ticks - 1) * prescale();
+  }
+
+static uint64_t cyclesUntilMs(double ms)
+  {
+  double c = (ms - nowMs) * simBusHz() / 1000.0;
+
+  // at least one cycle: a rounding error must not stall time just short of ms
+  if (c <= 0)
+    return 0;
+  return c < 1.0 ? 1 : (uint64_t)(c + 0.999999);
+  }
+
+#define NO_EVENT ((uint64_t)-1)
+
+// Delay to the next output-compare match on any channel configured as output
+static uint64_t nextCompareDelay(void)
+  {
+  uint64_t best = NO_EVENT;
+  int ch;
+
+  if (timerRunning())
+    for (ch = 0; ch < 8; ch++)
+      if (reg8[SIM_TIOS] & (1 << ch))
+        best = std::min(best, cyclesUntilCount(tc[ch]));
+  return best;
+  }
+
+// Delay to the next TCNT wrap to 0x0000, where TOF is set
+static uint64_t nextOverflowDelay(void)
+  {
+  return timerRunning() ? cyclesUntilCount(0) : NO_EVENT;
+  }
+
+static uint64_t nextInputDelay(void)
+  {
+  return nextInput < inputs.size() ? cyclesUntilMs(inputs[nextInput].ms) : NO_EVENT;
+  }
+
+// Delay to the next duty or period boundary of PWM channel 6/7
+static uint64_t nextPwmDelay(void)
+  {
+  unsigned int target;
+
+  if (!pwmRunning())
+    return NO_EVENT;
+  target = (pwmCount < pwmDty) ? pwmDty : pwmPer;
+  return (uint64_t)(target - pwmCount) * pwmClock() - pwmPhase;
+  }
+
+static uint64_t nextEventDelay(void)
+  {
+  return std::min(std::min(std::min(nextCompareDelay(), nextInputDelay()), nextPwmDelay()),
+                  nextOverflowDelay());
+  }
+
+// ---------- Event processing ----------
+
+static void logSpeaker(unsigned char level)
+  {
+  SimEdge e = { nowMs, now, level };
+  speakerLog.push_back(e);
+  }
+
+static void logPins(unsigned char before)
+  {
+  if ((before ^ pins) & SPEAKER_PIN)
+    logSpeaker((pins & SPEAKER_PIN) != 0);
+  }
+
+static void setPwmOut(unsigned char level)
+  {
+  if (level != pwmOut)
+    logSpeaker(level);
+  pwmOut = level;
+  }
+
+// Start of a PWM period: latch the buffered period/duty, output to its start level
+static void pwmPeriodStart(void)
+  {
+  pwmCount = 0;
+  pwmPer = pwmPerReg;
+  pwmDty = pwmDtyReg;
+  setPwmOut(((reg8[SIM_PWMPOL] & PWM_CH7) != 0) == (pwmDty != 0));
+  }
+
+static void pwmEvent(void)
+  {
+  if (pwmCount >= pwmPer)
+    pwmPeriodStart();
+  else if (pwmCount == pwmDty)
+    setPwmOut(!(reg8[SIM_PWMPOL] & PWM_CH7));
+  }
+
+// Set the flag of a vector; its wait starts at the first request only
+static void raiseFlag(int vec)
+  {
+  if (vec == SIM_VEC_TIMOVF)
+    {
+    if (!(reg8[SIM_TFLG2] & TFLG2_TOF))
+      flagSince[vec] = now;
+    reg8[SIM_TFLG2] |= TFLG2_TOF;
+    }
+  else
+    {
+    if (!(reg8[SIM_TFLG1] & (1 << vec)))
+      flagSince[vec] = now;
+    reg8[SIM_TFLG1] |= (unsigned char)(1 << vec);
+    }
+  }
+
+static void outputCompare(int ch)
+  {
+  unsigned char before = pins;
+  unsigned char ctl = (ch < 4) ? reg8[SIM_TCTL2] : reg8[SIM_TCTL1];
+  unsigned char mask = (unsigned char)(1 << ch);
+
+  switch ((ctl >> ((ch & 3) * 2)) & 0x03)
+    {
+    case 1: pins ^= mask;  break;          // toggle
+    case 2: pins &= ~mask; break;          // clear
+    case 3: pins |= mask;  break;          // set
+    default: break;                        // disconnected
+    }
+  raiseFlag(ch);
+  logPins(before);
+  }
+
+static void inputEdge(const SimInput &in)
+  {
+  unsigned char mask = (unsigned char)(1 << in.channel);
+  unsigned char ctl = (in.channel < 4) ? reg8[SIM_TCTL4] : reg8[SIM_TCTL3];
+  unsigned char edge = (ctl >> ((in.channel & 3) * 2)) & 0x03;
+  unsigned char rising = in.level && !(pins & mask);
+  unsigned char falling = !in.level && (pins & mask);
+
+  if (in.level)
+    pins |= mask;
+  else
+    pins &= ~mask;
+
+  if (reg8[SIM_TIOS] & mask)
+    return;                                // pin owned by an output compare
+  if ((rising && (edge & 1)) || (falling && (edge & 2)))
+    {
+    tc[in.channel] = tcnt;                 // capture
+    raiseFlag(in.channel);
+    }
+  }
+
+static void moveCounter(uint64_t cycles)
+  {
+  uint64_t total;
+
+  now += cycles;
+  nowMs += cycles * 1000.0 / simBusHz();
+  if (pwmRunning())
+    {
+    total = pwmPhase + cycles;
+    pwmCount += (unsigned int)(total / pwmClock());
+    pwmPhase = (unsigned int)(total % pwmClock());
+    }
+  if (!timerRunning())
+    return;
+  total = tickPhase + cycles;
+  tcnt = (unsigned short)(tcnt + total / prescale());
+  tickPhase = (unsigned int)(total % prescale());
+  }
+
+// Advance target time by the given number of bus cycles, firing every event on the way
+static void advance(uint64_t cycles)
+  {
+  while (cycles > 0)
+    {
+    uint64_t compare = nextCompareDelay();
+    uint64_t pwm = nextPwmDelay();
+    uint64_t overflow = nextOverflowDelay();
+    uint64_t delay = std::min(std::min(std::min(compare, nextInputDelay()), pwm), overflow);
+    int ch;
+
+    if (delay == NO_EVENT || delay > cycles)
+      {
+      moveCounter(cycles);
+      break;
+      }
+    moveCounter(delay);
+    cycles -= delay;
+
+    if (delay == compare)
+      for (ch = 0; ch < 8; ch++)
+        if ((reg8[SIM_TIOS] & (1 << ch)) && tc[ch] == tcnt)
+          outputCompare(ch);
+
+    if (delay == pwm)
+      pwmEvent();
+
+    if (delay == overflow)
+      raiseFlag(SIM_VEC_TIMOVF);
+
+    while (nextInput < inputs.size() && inputs[nextInput].ms <= nowMs)
+      inputEdge(inputs[nextInput++]);
+    }
+  if (nowMs > limitMs)
+    longjmp(simExit, 1);
+  }
+
+// ---------- Interrupts ----------
+
+// Pending interrupt requests, one bit per vector
+static unsigned int pendingChannels(void)
+  {
+  unsigned int pending = reg8[SIM_TFLG1] & reg8[SIM_TIE];
+
+  if ((reg8[SIM_TFLG2] & TFLG2_TOF) && (reg8[SIM_TSCR2] & TSCR2_TOI))
+    pending |= 1u << SIM_VEC_TIMOVF;
+  return pending;
+  }
+
+static void service(void);
+
+// Run cycles of ISR work, letting pending interrupts in whenever the I bit is clear
+static void burn(uint64_t cycles)
+  {
+  while (cycles > 0)
+    {
+    uint64_t step;
+
+    service();
+    step = std::min(cycles, std::max(nextEventDelay(), (uint64_t)1));
+    advance(step);
+    cycles -= step;
+    }
+  }
+
+static void addWait(SimWait *w, uint64_t wait)
+  {
+  if (!w->count || wait < w->min)
+    w->min = wait;
+  if (wait > w->max)
+    w->max = wait;
+  w->count++;
+  w->sum += wait;
+  w->sumSquares += (double)wait * wait;
+  }
+
+static void recordWait(int vec)
+  {
+  addWait(&isrWait[vec], now - flagSince[vec]);
+  }
+
+// Dispatch pending interrupts in vector priority order (TC0 highest, TOF last),
+// the vector HPRIO points at (low byte of its vector address) ahead of all
+static void service(void)
+  {
+  while (!iBit)
+    {
+    unsigned int pending = pendingChannels();
+    int promoted = (0xEE - reg8[SIM_HPRIO]) / 2;   // Vtimch0 is at 0xFFEE, TOF at 0xFFDE
+    unsigned char saveI;
+    uint64_t start, saveWork;
+    int vec;
+
+    if (!pending)
+      return;
+    if (reg8[SIM_HPRIO] <= 0xEE && promoted < SIM_NUM_VECTORS && (pending & (1u << promoted)))
+      vec = promoted;
+    else
+      for (vec = 0; !(pending & (1 << vec)); vec++)
+        ;
+    if (!vectors[vec])
+      {
+      fprintf(stderr, "sim: unhandled interrupt on TIM vector %d\n", vec);
+      longjmp(simExit, 2);
+      }
+
+    start = now;
+    advance((waiStacked ? SIM_WAI_WAKE_CYCLES : SIM_ISR_ENTRY_CYCLES) + isrLatency);
+    waiStacked = 0;
+    recordWait(vec);
+    saveI = iBit;
+    iBit = 1;
+    inIsr++;
+    saveWork = workOwed;
+    workOwed = isrWork[vec];
+    vectors[vec]();
+    burn(workOwed);
+    workOwed = saveWork;
+    inIsr--;
+    advance(SIM_RTI_CYCLES);
+    iBit = saveI;
+    isrCount[vec]++;
+    isrCycles[vec] += now - start;
+    }
+  }
+
+void simCli(void)
+  {
+  iBit = 0;
+  if (inIsr && workOwed)
+    {
+    uint64_t work = workOwed;              // the body goes on with interrupts open
+
+    workOwed = 0;
+    burn(work);
+    }
+  service();
+  }
+
+void simSei(void)
+  {
+  iBit = 1;
+  }
+
+unsigned char simCcr(void)
+  {
+  return iBit ? 0x10 : 0x00;
+  }
+
+// Idle instruction in a wait loop: skip to the next event instead of spinning
+static void idle(void)
+  {
+  uint64_t delay;
+
+  if (!iBit && pendingChannels())
+    {
+    service();
+    return;
+    }
+  // Nothing but the overflow tick can wake the loop up: the run is over
+  if (iBit || (!(reg8[SIM_TIE] & reg8[SIM_TIOS]) && nextInput >= inputs.size()))
+    longjmp(simExit, 1);
+
+  delay = nextEventDelay();
+  if (delay == NO_EVENT)
+    longjmp(simExit, 1);
+  advance(delay);
+  spinCycles += delay;
+  service();
+  }
+
+// WAI: stack, sleep until an interrupt is pending, take it without stacking
+static void waitForInterrupt(void)
+  {
+  uint64_t delay, wake;
+
+  advance(SIM_WAI_CYCLES);
+  if (iBit || (!(reg8[SIM_TIE] & reg8[SIM_TIOS]) && nextInput >= inputs.size() &&
+               !pendingChannels()))
+    longjmp(simExit, 1);
+  while (!pendingChannels())
+    {
+    delay = nextEventDelay();
+    if (delay == NO_EVENT)
+      longjmp(simExit, 1);
+    advance(delay);
+    waiCycles += delay;
+    }
+  wake = now;
+  waiStacked = 1;
+  service();
+  addWait(&wakeLatency, now - wake);
+  }
+
+void simAsm(const char *insn)
+  {
+  if (!strcmp(insn, "cli"))
+    iBit = 0;                              // no service(): the next instruction runs first
+  else if (!strcmp(insn, "wai"))
+    waitForInterrupt();
+  else
+    idle();
+  }
+
+// ---------- Register file ----------
+
+unsigned char simRead8(int id)
+  {
+  unsigned char value;
+
+  advance(SIM_REG_ACCESS_CYCLES);
+  switch (id)
+    {
+    case SIM_PTT:    value = pins; break;
+    case SIM_CRGFLG:                                            // LOCK pllLockUs after PLLON
+      value = reg8[id];
+      if ((reg8[SIM_PLLCTL] & PLLCTL_PLLON) && pllLockUs >= 0 && nowMs >= pllLockMs)
+        value |= CRGFLG_LOCK;
+      break;
+    case SIM_SCI0SR1: value = SCI_TDRE_TC; break;                // transmitter never busy
+    case SIM_ATD0STAT0:
+    case SIM_ATD0DR0H:
+      if (atdDone && now >= atdDone)                            // conversion complete
+        {
+        reg8[SIM_ATD0DR0H] = atdNext;
+        reg8[SIM_ATD0STAT0] |= ATD_SCF;
+        atdDone = 0;
+        }
+      value = reg8[id];
+      if (id == SIM_ATD0DR0H && (reg8[SIM_ATD0CTL2] & ATD_AFFC))
+        reg8[SIM_ATD0STAT0] &= ~ATD_SCF;
+      break;
+    default:         value = reg8[id]; break;
+    }
+  return value;
+  }
+
+void simWrite8(int id, unsigned char value)
+  {
+  advance(SIM_REG_ACCESS_CYCLES);
+  switch (id)
+    {
+    case SIM_TFLG1:
+    case SIM_TFLG2:
+      reg8[id] &= ~value;                  // write 1 to clear
+      break;
+    case SIM_PLLCTL:
+      if ((value & PLLCTL_PLLON) && !(reg8[id] & PLLCTL_PLLON))
+        pllLockMs = nowMs + pllLockUs / 1000.0;
+      reg8[id] = value;
+      break;
+    case SIM_PTM:
+      if (value != reg8[id] || ledLog.empty())
+        {
+        SimEdge e = { nowMs, now, value };
+        ledLog.push_back(e);
+        }
+      reg8[id] = value;
+      break;
+    case SIM_PTT:
+      {
+      // only port bits configured as plain outputs follow the data register
+      unsigned char before = pins;
+      unsigned char mask = reg8[SIM_DDRT] & ~reg8[SIM_TIOS];
+      pins = (pins & ~mask) | (value & mask);
+      reg8[id] = value;
+      logPins(before);
+      }
+      break;
+    case SIM_PWME:
+      if ((value & ~reg8[id]) & PWM_CH7)
+        {
+        reg8[id] = value;                  // enabling restarts the counter
+        pwmPhase = 0;
+        pwmPeriodStart();
+        }
+      else if ((reg8[id] & ~value) & PWM_CH7)
+        {
+        reg8[id] = value;                  // disabling holds the output at its idle level
+        setPwmOut(!(reg8[SIM_PWMPOL] & PWM_CH7));
+        }
+      reg8[id] = value;
+      break;
+    case SIM_TSCR1:
+      if (!(reg8[id] & TSCR1_TEN))
+        tickPhase = 0;
+      reg8[id] = value;
+      break;
+    case SIM_MCCTL:
+      if ((value & ~reg8[id]) & MCCTL_MCEN)
+        mcStart = now;                     // enabling starts counting from the load value
+      reg8[id] = value;
+      break;
+    case SIM_SCI0DRL:
+      if (reg8[SIM_SCI0CR2] & SCI_TE)
+        sciOutput += (char)value;
+      reg8[id] = value;
+      break;
+    case SIM_ATD0CTL5:                     // starts a conversion, sampled now
+      reg8[id] = value;
+      if (reg8[SIM_ATD0CTL2] & ATD_ADPU)
+        {
+        double v = analogIn ? analogIn(nowMs) : 0.5;
+
+        atdNext = (unsigned char)(v <= 0 ? 0 : v >= 1 ? 255 : (int)(v * 256.0));
+        atdDone = now + ATD_CONV_CLOCKS * 2 * ((reg8[SIM_ATD0CTL4] & ATD_PRS_MASK) + 1);
+        reg8[SIM_ATD0STAT0] &= ~ATD_SCF;
+        }
+      break;
+    default:
+      reg8[id] = value;
+      break;
+    }
+  service();
+  }
+
+unsigned short simRead16(int id)
+  {
+  unsigned short value;
+
+  advance(SIM_REG_ACCESS_CYCLES);
+  switch (id)
+    {
+    case SIM_TCNT:     value = tcnt; break;
+    case SIM_PWMCNT67: value = (unsigned short)pwmCount; break;
+    case SIM_PWMPER67: value = pwmPerReg; break;
+    case SIM_PWMDTY67: value = pwmDtyReg; break;
+    case SIM_MCCNT:    value = modulusCount(); break;
+    case SIM_SCI0BD:   value = sciBaud; break;
+    default:           value = tc[id - SIM_TC0]; break;
+    }
+  return value;
+  }
+
+void simWrite16(int id, unsigned short value)
+  {
+  advance(SIM_REG_ACCESS_CYCLES);
+  switch (id)
+    {
+    case SIM_TCNT:                         // TCNT is only writable in special modes
+      break;
+    case SIM_PWMCNT67:                     // any write resets the counter
+      pwmCount = 0;
+      break;
+    case SIM_PWMPER67:
+      pwmPerReg = value;
+      if (!(reg8[SIM_PWME] & PWM_CH7))
+        pwmPer = value;                    // buffer is transparent while disabled
+      break;
+    case SIM_PWMDTY67:
+      pwmDtyReg = value;
+      if (!(reg8[SIM_PWME] & PWM_CH7))
+        pwmDty = value;
+      break;
+    case SIM_MCCNT:                        // sets the load register and restarts
+      mcLoad = value;
+      mcStart = now;
+      break;
+    case SIM_SCI0BD:
+      sciBaud = value;
+      break;
+    default:
+      tc[id - SIM_TC0] = value;
+      break;
+    }
+  service();
+  }
+
+// ---------- Driver interface ----------
+
+void simSetVector(int vector, SimIsr isr)
+  {
+  vectors[vector] = isr;
+  }
+
+void simReset(double oscHz)
+  {
+  int i;
+
+  for (i = 0; i < SIM_NUM_REG8; i++)
+    reg8[i] = 0;
+  for (i = 0; i < 8; i++)
+    tc[i] = 0;
+  for (i = 0; i < SIM_NUM_VECTORS; i++)
+    {
+    isrCount[i] = 0;
+    isrCycles[i] = 0;
+    isrWork[i] = 0;
+    flagSince[i] = 0;
+    isrWait[i] = SimWait();
+    }
+  workOwed = 0;
+  wakeLatency = SimWait();
+  waiCycles = spinCycles = 0;
+  waiStacked = 0;
+  reg8[SIM_HPRIO] = 0xF2;                  // out of reset: IRQ promoted, timer order untouched
+  tcnt = 0;
+  tickPhase = 0;
+  pins = 0xF0;                             // buttons idle high (pull-ups)
+  pwmPer = pwmDty = pwmPerReg = pwmDtyReg = 0;
+  pwmCount = pwmPhase = 0;
+  pwmOut = 0;
+  mcLoad = 0;
+  mcStart = 0;
+  sciBaud = 0;
+  analogIn = 0;
+  atdDone = 0;
+  atdNext = 0;
+  iBit = 1;                                // I bit is set out of reset
+  inIsr = 0;
+  now = 0;
+  nowMs = 0;
+  oscillatorHz = oscHz;
+  pllLockUs = 0;
+  pllLockMs = 0;
+  bounceMs = 0;
+  bounceGlitches = 0;
+  limitMs = 60000.0;
+  isrLatency = 0;
+  inputs.clear();
+  nextInput = 0;
+  ledLog.clear();
+  speakerLog.clear();
+  sciOutput.clear();
+  }
+
+void simSetLimit(double ms)
+  {
+  limitMs = ms;
+  }
+
+void simSetIsrLatency(unsigned int cycles)
+  {
+  isrLatency = cycles;
+  }
+
+void simSetPllLock(double us)
+  {
+  pllLockUs = us;
+  }
+
+void simSetBounce(double ms, int glitches)
+  {
+  bounceMs = ms;
+  bounceGlitches = glitches;
+  }
+
+void simSetAnalog(double (*input)(double ms))
+  {
+  analogIn = input;
+  }
+
+void simSetIsrWork(int vector, unsigned int cycles)
+  {
+  isrWork[vector] = cycles;
+  }
+
+static bool earlier(const SimInput &a, const SimInput &b)
+  {
+  return a.ms < b.ms;
+  }
+
+// An edge to level, then the glitches of its bounce evenly over bounceMs
+static void pushEdge(int channel, double atMs, unsigned char level)
+  {
+  double step = bounceGlitches ? bounceMs / (2 * bounceGlitches) : 0;
+  int k;
+
+  for (k = 0; k <= 2 * bounceGlitches; k++)
+    {
+    SimInput edge = { atMs + k * step, channel, (unsigned char)(level ^ (k & 1)) };
+    inputs.push_back(edge);
+    }
+  }
+
+void simPushButton(int channel, double atMs, double holdMs)
+  {
+  pushEdge(channel, atMs, 0);
+  pushEdge(channel, atMs + holdMs, 1);
+  std::stable_sort(inputs.begin(), inputs.end(), earlier);
+  }
+
+int simRun(void (*entry)(void))
+  {
+  int status = setjmp(simExit);
+
+  if (status == 0)
+    {
+    entry();
+    status = 1;
+    }
+  iBit = 1;
+  inIsr = 0;
+  return status == 1 ? 0 : status;
+  }
+
+uint64_t simCycles(void)
+  {
+  return now;
+  }
+
+double simMs(void)
+  {
+  return nowMs;
+  }
+
+unsigned long simIsrCount(int vector)
+  {
+  return isrCount[vector];
+  }
+
+uint64_t simIsrCycles(int vector)
+  {
+  return isrCycles[vector];
+  }
+
+const SimWait *simIsrWait(int vector)
+  {
+  return &isrWait[vector];
+  }
+
+const SimWait *simWakeLatency(void)
+  {
+  return &wakeLatency;
+  }
+
+uint64_t simWaiCycles(void)
+  {
+  return waiCycles;
+  }
+
+uint64_t simSpinCycles(void)
+  {
+  return spinCycles;
+  }
+
+const SimEdge *simLedLog(unsigned long *count)
+  {
+  *count = ledLog.size();
+  return ledLog.empty() ? 0 : &ledLog[0];
+  }
+
+const SimEdge *simSpeakerLog(unsigned long *count)
+  {
+  *count = speakerLog.size();
+  return speakerLog.empty() ? 0 : &speakerLog[0];
+  }
+
+const char *simSciOutput(void)
+  {
+  return sciOutput.c_str();
+  }
@@ -0,0 +1,153 @@
+/********************************************************************************
+*  File:  simHCS12.h
+*  Description: Host (Linux) model of the MC9S12DP512 peripherals used by LAB1.
+*
+*       The lab sources are compiled unchanged against Sim/mc9s12dp512.h and
+*       Sim/hidef.h, which map every register onto a SimReg8/SimReg16 object.
+*       Each access goes through simRead/simWrite below, so write-1-to-clear
+*       flags, free-running TCNT and compare matches behave like the chip.
+*
+*       Time is kept in bus cycles.  Every register access costs
+*       SIM_REG_ACCESS_CYCLES, interrupt entry/exit cost the HCS12 stacking
+*       and RTI times, and an idle loop (asm("nop")) skips straight to the
+*       next compare, counter overflow or input-capture event.
+*       asm("wai") sleeps to the next interrupt the same way, stacking
+*       first, and counts the time asleep and from each wakeup back to the
+*       code after the WAI; asm("cli") clears the I bit, taking no interrupt
+*       before the next instruction as on the CPU12.
+*       Interrupts nest when an ISR clears the I bit, and HPRIO promotes one
+*       vector above the others, as on the chip.
+*********************************************************************************/
+
+#ifndef SIM_HCS12_H
+#define SIM_HCS12_H
+
+#include <stdint.h>
+
+// Cycle costs of the CPU model
+#define SIM_REG_ACCESS_CYCLES  3     // load/store/RMW to a register, rough mean
+#define SIM_ISR_ENTRY_CYCLES   9     // vector fetch + stacking of CCR, D, X, Y, PC
+#define SIM_RTI_CYCLES         8     // unstacking on RTI
+#define SIM_WAI_CYCLES         8     // WAI: stacking before the CPU clock stops
+#define SIM_WAI_WAKE_CYCLES    6     // vector fetch on the wakeup, stacked already
+
+// Register identifiers of the simulated register file
+enum SimRegId
+  {
+  // ECT / TIM
+  SIM_TIOS, SIM_CFORC, SIM_OC7M, SIM_OC7D, SIM_TSCR1, SIM_TTOV,
+  SIM_TCTL1, SIM_TCTL2, SIM_TCTL3, SIM_TCTL4, SIM_TIE, SIM_TSCR2,
+  SIM_TFLG1, SIM_TFLG2,
+  // PWM
+  SIM_PWME, SIM_PWMPOL, SIM_PWMCLK, SIM_PWMPRCLK, SIM_PWMCAE, SIM_PWMCTL, SIM_PWMSCLB,
+  // Ports
+  SIM_PTT, SIM_DDRT, SIM_PTM, SIM_DDRM,
+  // CRG and MEBI
+  SIM_SYNR, SIM_REFDV, SIM_CRGFLG, SIM_CLKSEL, SIM_PLLCTL, SIM_MODE, SIM_MISC, SIM_PPAGE,
+  // ECT modulus down-counter, SCI0
+  SIM_MCCTL, SIM_SCI0CR1, SIM_SCI0CR2, SIM_SCI0SR1, SIM_SCI0DRL,
+  // ATD0 (8-bit single conversions on one input)
+  SIM_ATD0CTL2, SIM_ATD0CTL3, SIM_ATD0CTL4, SIM_ATD0CTL5, SIM_ATD0STAT0, SIM_ATD0DR0H,
+  // Interrupt module
+  SIM_HPRIO,
+  SIM_NUM_REG8,
+
+  // 16-bit registers
+  SIM_TCNT = 0x100,
+  SIM_TC0, SIM_TC1, SIM_TC2, SIM_TC3, SIM_TC4, SIM_TC5, SIM_TC6, SIM_TC7,
+  SIM_PWMCNT67, SIM_PWMPER67, SIM_PWMDTY67,
+  SIM_MCCNT, SIM_SCI0BD
+  };
+
+unsigned char  simRead8(int id);
+void           simWrite8(int id, unsigned char value);
+unsigned short simRead16(int id);
+void           simWrite16(int id, unsigned short value);
+
+// 8-bit register: every read and write is routed to the model
+class SimReg8
+  {
+  public:
+    explicit SimReg8(int regId) : id(regId) {}
+    operator unsigned char() const            { return simRead8(id); }
+    SimReg8& operator=(unsigned int v)        { simWrite8(id, (unsigned char)v); return *this; }
+    SimReg8& operator=(const SimReg8& r)      { simWrite8(id, (unsigned char)r); return *this; }
+    SimReg8& operator|=(unsigned int v)       { simWrite8(id, (unsigned char)(simRead8(id) | v)); return *this; }
+    SimReg8& operator&=(unsigned int v)       { simWrite8(id, (unsigned char)(simRead8(id) & v)); return *this; }
+    SimReg8& operator^=(unsigned int v)       { simWrite8(id, (unsigned char)(simRead8(id) ^ v)); return *this; }
+  private:
+    int id;
+  };
+
+// 16-bit register
+class SimReg16
+  {
+  public:
+    explicit SimReg16(int regId) : id(regId) {}
+    operator unsigned short() const           { return simRead16(id); }
+    SimReg16& operator=(unsigned int v)       { simWrite16(id, (unsigned short)v); return *this; }
+    SimReg16& operator=(const SimReg16& r)    { simWrite16(id, (unsigned short)r); return *this; }
+    SimReg16& operator+=(unsigned int v)      { simWrite16(id, (unsigned short)(simRead16(id) + v)); return *this; }
+  private:
+    int id;
+  };
+
+/**** CPU hooks used by Sim/hidef.h ****/
+void simCli(void);                 // EnableInterrupts
+void simSei(void);                 // DisableInterrupts
+unsigned char simCcr(void);        // SAVE_CCR: the CCR, I bit only
+void simAsm(const char *insn);     // asm("...") in the lab sources
+
+/**** Vector table (filled in by the driver) ****/
+typedef void (*SimIsr)(void);
+enum SimVector
+  {
+  SIM_VEC_TIMCH0, SIM_VEC_TIMCH1, SIM_VEC_TIMCH2, SIM_VEC_TIMCH3,
+  SIM_VEC_TIMCH4, SIM_VEC_TIMCH5, SIM_VEC_TIMCH6, SIM_VEC_TIMCH7,
+  SIM_VEC_TIMOVF,                  // below the channels, as on the chip
+  SIM_NUM_VECTORS
+  };
+void simSetVector(int vector, SimIsr isr);
+
+/**** Driver interface ****/
+void     simReset(double oscHz);
+void     simSetLimit(double ms);                        // stop the run after this much target time
+void     simSetIsrLatency(unsigned int cycles);         // extra cycles before each ISR body runs
+void     simSetPllLock(double us);                      // PLL lock time after PLLON, < 0 never
+void     simSetIsrWork(int vector, unsigned int cycles);  // C work in the body the register model
+                                                        // can't see: charged where the body clears
+                                                        // the I bit, else once it returns
+void     simSetBounce(double ms, int glitches);            // contact bounce of the buttons pushed next
+void     simPushButton(int channel, double atMs, double holdMs);
+void     simSetAnalog(double (*input)(double ms));      // ATD0 input at a time, 0..1 of VRH
+int      simRun(void (*entry)(void));                   // runs entry until idle forever or limit
+uint64_t simCycles(void);                               // bus cycles since reset
+double   simBusHz(void);                                // current bus clock
+double   simMs(void);                                   // target time since reset
+unsigned long simIsrCount(int vector);
+uint64_t simIsrCycles(int vector);                      // cycles spent in the vector incl. entry/RTI
+
+// Wait of a vector: bus cycles from its flag being set to its body starting
+struct SimWait
+  {
+  unsigned long count;
+  uint64_t      min, max, sum;
+  double        sumSquares;
+  };
+const SimWait *simIsrWait(int vector);
+const SimWait *simWakeLatency(void);     // interrupt waking a WAI to the code after it
+uint64_t simWaiCycles(void);             // bus cycles asleep in WAI
+uint64_t simSpinCycles(void);            // and idle in a nop loop, awake
+
+// Recorded pin activity
+struct SimEdge
+  {
+  double        ms;
+  uint64_t      cycle;
+  unsigned char value;
+  };
+const SimEdge *simLedLog(unsigned long *count);        // every change written to PTM
+const SimEdge *simSpeakerLog(unsigned long *count);    // every level change on PT3 or PP7
+const char    *simSciOutput(void);                     // every character sent on SCI0
+
+#endif /* SIM_HCS12_H */
@@ -0,0 +1,1774 @@
+/********************************************************************************
+*  File:  simMain.cpp
+*  Description: Host driver for the LAB1 simulator.
+*
+*       Binds the lab ISRs to the simulated vector table (the host equivalent
+*       of the interrupt numbers in initLAB1.c), runs main() from main.c until
+*       the program goes idle for good, and prints what the board would have
+*       done: the LED pattern timeline, the tone heard in each element and
+*       the interrupt load.
+*
+*       -d N replaces main() with an N-symbol message and reports how far the
+*       element boundaries drift from their ideal, latency-free positions.
+*       -m sends a text through the runtime ASCII encoder instead, at the
+*       speed given by -w (setWPM) or the compile-time default timing.
+*       -q N sends N copies of a message through the transmit queue and
+*       reports the dead air between them; -r N restarts each copy from
+*       main() once the previous one has stopped, for comparison.
+*       -b S repeats a beacon every S seconds from setAlarm() and reports
+*       how far each start is from its 32-bit deadline.
+*       -f sends one long tone and reports the pitch delivered over all of it.
+*       -s S sends text for S seconds while all four buttons are pressed at
+*       random, and counts the button and speaker interrupts that got lost.
+*       The speaker's half-period jitter at the pin and the wait of
+*       SpeakerISR (flag to body) are reported with it.
+*       -l adds a fixed latency to every interrupt, standing in for masked
+*       foreground sections or another ISR already in service.
+*       -c adds C work the register model doesn't see to an ISR body, e.g.
+*       the element decoding in toneDurationISR (vector = TIM channel, 8 = TOF).
+*       -k sets the PLL lock time in us (negative: never locks) and reports
+*       the time from main() to the first SPEAKER_TC compare, the boot dead
+*       air of a beacon (Start12's Init runs before main and isn't modelled).
+*       -K keys the text on SW4 as a straight key, at wpm or going from wpm
+*       to end_wpm, with a jittery fist, while text is being sent, and
+*       prints what startKey()/pumpKey() decoded and the speaker jitter.
+*       -P runs the iambic keyer in mode A or B with dit/dah paddles on SW1
+*       and SW2, pressed by -p 4:... and -p 5:..., and prints the elements
+*       keyed and the time from each paddle edge that starts the keyer to
+*       the first sidetone edge on PT3.
+*       -A keys the text as a tone in noise into ATD0 (-O also saves it as a
+*       WAV file), -R plays a WAV file into it instead, with the text it
+*       holds if known. Either way the receiver (startReceiver/pumpReceiver
+*       /pumpKey) decodes it while text is being sent; the decoded text, its
+*       character error rate, the speaker jitter and the Goertzel kernel's
+*       host time per sample are printed.
+*       -W starts that many software timers, each re-armed from its callback
+*       at a random period up to max_period_ms, all on the alarm compare
+*       while text is being sent, and prints how late the callbacks ran,
+*       alarmISR calls and cycles per expiry, the speaker jitter and the
+*       host time of a timer's removal and insertion.
+*       -L sends a text on one LED at wpm with startLane(), up to four of
+*       them side by side (lane = order of the options, LED1 down), and
+*       prints each lane's text decoded back from its LED, how far its edges
+*       are from its own timing and alarmISR's cycles per lane transition.
+*       -n makes every button edge bounce: glitches pulses back to the old
+*       level over bounce_ms (3 by default), for the unlock debounce.
+*       Every run also prints where main idled between interrupts: asleep
+*       in WAI (waitEvent(), with the time from each wakeup back to main and
+*       the events taken) or awake in a nop loop (EVENT_LOOP 0).
+*       Built with ISR_PROFILE=1, every run ends with the lab's own isrStats[]
+*       table printed by dumpIsrStats() over the simulated SCI0.
+*
+*  Usage: lab1sim [-o osc_MHz] [-t limit_ms] [-l latency_cycles]
+*                 [-p channel:at_ms[:hold_ms]]... [-d symbols] [-m text]
+*                 [-q messages | -r messages] [-w wpm[:fwpm[:dash_weight]]]
+*                 [-b beacon_period_s] [-f freq_Hz[:seconds]] [-s seconds]
+*                 [-c vector:cycles]... [-k pll_lock_us] [-n bounce_ms[:glitches]]
+*                 [-K text[:wpm[:end_wpm]]] [-P A|B]
+*                 [-A text[:wpm[:snr_dB[:tone_Hz]]] [-O out.wav] | -R in.wav[:text]]
+*                 [-W timers[:max_period_ms]] [-L text[:wpm]]...
+*********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <ctype.h>
+
+#include "simHCS12.h"
+#include "initLAB1.h"
+
+// Lab entry point (main.c is compiled with -Dmain=lab1_main)
+void lab1_main(void);
+
+// ISRs of initLAB1.c; weak so a build without one of them still links
+void toneDurationISR(void) __attribute__((weak));
+void SpeakerISR(void)      __attribute__((weak));
+void alarmISR(void)        __attribute__((weak));
+void rxSampleISR(void)     __attribute__((weak));
+void timerOverflowISR(void) __attribute__((weak));
+void SW1_ISR(void)         __attribute__((weak));
+void SW2_ISR(void)         __attribute__((weak));
+void SW3_ISR(void)         __attribute__((weak));
+void SW4_ISR(void)         __attribute__((weak));
+
+static const char *vectorNames[SIM_NUM_VECTORS] =
+  { "toneDurationISR", "alarmISR", "rxSampleISR", "SpeakerISR", "SW1_ISR", "SW2_ISR", "SW3_ISR", "SW4_ISR",
+    "timerOverflowISR" };
+
+static void bindVectors(void)
+  {
+  simSetVector(SIM_VEC_TIMCH0, toneDurationISR);
+  simSetVector(SIM_VEC_TIMCH1, alarmISR);
+  simSetVector(SIM_VEC_TIMCH2, rxSampleISR);
+  simSetVector(SIM_VEC_TIMCH3, SpeakerISR);
+  simSetVector(SIM_VEC_TIMCH4, SW1_ISR);
+  simSetVector(SIM_VEC_TIMCH5, SW2_ISR);
+  simSetVector(SIM_VEC_TIMCH6, SW3_ISR);
+  simSetVector(SIM_VEC_TIMCH7, SW4_ISR);
+  simSetVector(SIM_VEC_TIMOVF, timerOverflowISR);
+  }
+
+// Board bring-up shared by the scenarios, in main.c's order: clock, TIM,
+// ports, then the scenario's own setup (sources, keys, timers) with the
+// I bit still set, then interrupts on
+static void bootBoard(void (*setup)(void))
+  {
+  setECLK_MODE();
+  initTIM();
+  initPTM();
+  initPTT();
+  if (setup)
+    setup();
+  EnableInterrupts;
+  }
+
+/********************************************************************************
+*  Report: one line per LED pattern change with the tone heard meanwhile
+********************************************************************************/
+static void printTimeline(void)
+  {
+  unsigned long nLed, nSpk, i, s = 0;
+  const SimEdge *led = simLedLog(&nLed);
+  const SimEdge *spk = simSpeakerLog(&nSpk);
+
+  printf("    time ms   length ms  PTM   tone\n");
+  for (i = 0; i < nLed; i++)
+    {
+    double end = (i + 1 < nLed) ? led[i + 1].ms : simMs();
+    double firstRise = 0, lastRise = 0;
+    unsigned long rises = 0;
+
+    // period from rising edge to rising edge: partial periods at either end don't count
+    for (; s < nSpk && spk[s].ms < end; s++)
+      if (spk[s].value)
+        {
+        if (!rises++)
+          firstRise = spk[s].ms;
+        lastRise = spk[s].ms;
+        }
+
+    printf("%11.3f %11.3f  0x%02X  ", led[i].ms, end - led[i].ms, led[i].value);
+    if (rises >= 2)
+      printf("%7.2f Hz (%lu periods)\n", (rises - 1) * 1000.0 / (lastRise - firstRise), rises - 1);
+    else
+      printf("silent\n");
+    }
+  }
+
+// Events the scenarios' main loops took from waitEvent(), by EVENT_ number
+static unsigned long loopEvents[EVENT_COUNT];
+static const char *eventNames[EVENT_COUNT] = { "none", "text", "key", "rx", "unlocked" };
+
+#if EVENT_LOOP
+static unsigned char nextEvent(void)
+  {
+  unsigned char event = waitEvent();
+
+  loopEvents[event]++;
+  return event;
+  }
+#endif
+
+// The text scenarios' main loop: events (EVENT_LOOP 1) or polling in a nop loop
+static void textLoop(void)
+  {
+  for(;;)
+    {
+#if EVENT_LOOP
+    if (nextEvent() == EVENT_TEXT)
+      pumpText();
+#else
+    pumpText();
+    asm("nop");
+#endif
+    }
+  }
+
+// Where main spent the run between ISRs: asleep in WAI or awake in a nop loop
+static void printIdle(void)
+  {
+  const SimWait *wake = simWakeLatency();
+  double us = 1e6 / simBusHz();
+  int e;
+
+  if (simWaiCycles() || wake->count)
+    {
+    printf("\n  main asleep in WAI %.3f%% of the run, %lu wakeups\n",
+           100.0 * simWaiCycles() / simCycles(), wake->count);
+    printf("  wakeup to main: min %.2f us, mean %.2f us, max %.2f us (the ISRs included)\n",
+           wake->min * us, (double)wake->sum / wake->count * us, wake->max * us);
+    }
+  if (simSpinCycles())
+    printf("\n  main idle in a nop loop %.3f%% of the run, awake\n",
+           100.0 * simSpinCycles() / simCycles());
+  for (e = 1; e < EVENT_COUNT; e++)
+    if (loopEvents[e])
+      break;
+  if (e < EVENT_COUNT)
+    {
+    printf("  events:");
+    for (e = 1; e < EVENT_COUNT; e++)
+      if (loopEvents[e])
+        printf(" %s %lu", eventNames[e], loopEvents[e]);
+    printf("\n");
+    }
+  }
+
+static void printIsrLoad(void)
+  {
+  int v;
+
+  printf("\n  vector            calls     cycles  cycles/call   CPU load\n");
+  for (v = 0; v < SIM_NUM_VECTORS; v++)
+    if (simIsrCount(v))
+      printf("  %-16s %6lu %10llu %12.1f %9.3f%%\n", vectorNames[v], simIsrCount(v),
+             (unsigned long long)simIsrCycles(v),
+             (double)simIsrCycles(v) / simIsrCount(v),
+             100.0 * simIsrCycles(v) / simCycles());
+  }
+
+/********************************************************************************
+*  Scenario -d: long message, cumulative drift of the element boundaries
+********************************************************************************/
+#define MAX_DRIFT_SYMBOLS 20000
+static struct MorseCode driftMessage[MAX_DRIFT_SYMBOLS + 1];
+static int driftSymbols;
+
+static void driftSetup(void)
+  {
+  initCode(driftMessage);
+  }
+
+static void driftMain(void)
+  {
+  int i;
+
+  // dots and blanks alternate, so every element boundary changes the LEDs
+  for (i = 0; i < driftSymbols; i++)
+    {
+    driftMessage[i].tone     = (i & 1) ? blank : dot;
+    driftMessage[i].duration = (i & 1) ? blank_duration : dot_duration;
+    driftMessage[i].leds     = (i & 1) ? LEDSOFF : dotLED;
+    }
+  driftMessage[driftSymbols].tone = brk;
+
+  bootBoard(driftSetup);
+  sendCode();
+  for(;;)
+    asm("nop");
+  }
+
+// Tone frequency over all dot elements, from the first to the last speaker edge of each
+static double meanDotTone(void)
+  {
+  unsigned long nLed, nSpk, i, s = 0;
+  const SimEdge *led = simLedLog(&nLed);
+  const SimEdge *spk = simSpeakerLog(&nSpk);
+  double halfPeriods = 0, ms = 0;
+
+  for (i = 0; i + 1 < nLed; i++)
+    {
+    unsigned long first;
+
+    while (s < nSpk && spk[s].ms < led[i].ms)
+      s++;
+    first = s;
+    while (s < nSpk && spk[s].ms < led[i + 1].ms)
+      s++;
+    if (led[i].value == dotLED && s - first >= 3)
+      {
+      halfPeriods += s - first - 1;
+      ms += spk[s - 1].ms - spk[first].ms;
+      }
+    }
+  return ms > 0 ? halfPeriods * 1000.0 / (2.0 * ms) : 0;
+  }
+
+static void printDrift(void)
+  {
+  unsigned long nLed, i, first = 0;
+  const SimEdge *led = simLedLog(&nLed);
+  double cyclesPerTick = 1 << TIM_PRESCALER;   // TSCR2, 64 at 4 MHz
+  double ideal = 0, drift = 0, worst = 0;
+
+  // skip the writes made by initPTM/initCode before the first element
+  while (first < nLed && led[first].value != dotLED)
+    first++;
+  for (i = first; i < nLed && (long)(i - first) < driftSymbols; i++)
+    {
+    drift = (led[i].cycle - led[first].cycle) / cyclesPerTick - ideal;
+    if (drift > worst)
+      worst = drift;
+    ideal += driftMessage[i - first].duration;
+    }
+
+  printf("  %s scheduling, %d symbols (%.1f s)\n",
+         ABSOLUTE_SCHEDULING ? "absolute" : "TCNT-relative",
+         driftSymbols, ideal / TIM_TICK_HZ);
+  printf("  cumulative drift at last boundary: %.1f ticks (%.3f ms), worst %.1f ticks\n",
+         drift, drift * 1e3 / TIM_TICK_HZ, worst);
+  printf("  mean dot tone: %.2f Hz\n", meanDotTone());
+  }
+
+/********************************************************************************
+*  Scenario -m: text through the ASCII encoder
+********************************************************************************/
+static const struct MorseFormat textFormat =
+  {
+  dot, dash, dotLED, LED34, MORSE_DEFAULT_TIMING
+  };
+static const char *text;
+static int wpm, fwpm, dashWeight = 30;
+
+static void textSetup(void)
+  {
+  if (wpm && !setWPM((unsigned char)wpm, (unsigned char)fwpm, (unsigned char)dashWeight))
+    printf("  -w %d:%d:%d is out of range, default timing\n", wpm, fwpm, dashWeight);
+  initText(&textFormat, text);
+  }
+
+static void textMain(void)
+  {
+  bootBoard(textSetup);
+  sendCode();
+  textLoop();
+  }
+
+/********************************************************************************
+*  Scenario -q/-r: back-to-back messages, dead air at the message boundaries
+********************************************************************************/
+static const unsigned char queueSymbols[] =
+  {
+  MORSE_PACK(SYM_DOT,  SYM_DOT,  SYM_DOT,  SYM_DASH),
+  MORSE_PACK(SYM_DASH, SYM_DASH, SYM_DOT,  SYM_DOT),
+  MORSE_PACK(SYM_DOT,  SYM_WORD, 0,        0)
+  };
+static const struct MorseStream queueSample =        // SOS + word gap
+  {
+  { dot, dash, dotLED, LED34, MORSE_DEFAULT_TIMING },
+  10, queueSymbols
+  };
+static int queueMessages;
+static int restartMessages;
+
+static void queueSetup(void)
+  {
+  initStream(&queueSample);
+  }
+
+static void queueMain(void)
+  {
+  int sent = 1;
+
+  bootBoard(queueSetup);
+  sendCode();
+  for(;;)
+    {
+    if (restartMessages)
+      {
+      // baseline: wait for stopCode(), then start the next copy from main
+      if (!codeBusy() && sent < restartMessages)
+        {
+        initStream(&queueSample);
+        sendCode();
+        sent++;
+        }
+      }
+    else
+      while (sent < queueMessages && queueStream(&queueSample))
+        sent++;
+    asm("nop");
+    }
+  }
+
+// Length of a packed stream in ticks, decoded the way nextSymbol() does
+static unsigned long streamTicks(const struct MorseStream *s)
+  {
+  const struct MorseTiming *t = &s->format.timing;
+  unsigned long ticks = 0;
+  unsigned int pos;
+  int afterElement = 0;
+
+  for (pos = 0; pos < s->length; pos++)
+    {
+    unsigned char sym = (s->symbols[pos >> 2] >> ((3 - (pos & 3)) << 1)) & 0x03;
+
+    if (sym == SYM_DOT || sym == SYM_DASH)
+      {
+      if (afterElement)
+        ticks += t->gapTicks;
+      ticks += (sym == SYM_DOT) ? t->dotTicks : t->dashTicks;
+      afterElement = 1;
+      }
+    else
+      {
+      ticks += (sym == SYM_LETTER) ? t->letterTicks : t->wordTicks;
+      afterElement = 0;
+      }
+    }
+  return afterElement ? ticks + t->gapTicks : ticks;
+  }
+
+static void printQueueGaps(void)
+  {
+  unsigned long nLed, i, first = 0, last = 0;
+  const SimEdge *led = simLedLog(&nLed);
+  int messages = restartMessages ? restartMessages : queueMessages;
+  double cyclesPerTick = 1 << TIM_PRESCALER;   // TSCR2, 64 at 4 MHz
+  double ideal = (double)streamTicks(&queueSample) * messages * cyclesPerTick;
+  double dead;
+
+  // first dot of the first message to the final stopCode()
+  while (first < nLed && led[first].value != dotLED)
+    first++;
+  for (i = first; i < nLed; i++)
+    if (led[i].value == (unsigned char)~LEDSOFF)
+      last = i;
+  dead = (double)(led[last].cycle - led[first].cycle) - ideal;
+
+  printf("  %d messages %s, %.3f s each\n", messages,
+         restartMessages ? "restarted from main" : "through the transmit queue",
+         (double)streamTicks(&queueSample) / TIM_TICK_HZ);
+  printf("  dead air: %.0f bus cycles total, %.1f cycles (%.2f us) per message boundary\n",
+         dead, messages > 1 ? dead / (messages - 1) : 0.0,
+         messages > 1 ? dead / (messages - 1) * 1e6 / simBusHz() : 0.0);
+  }
+
+/********************************************************************************
+*  Scenario -b: beacon repeated from the alarm, deadlines far beyond 16 bits
+********************************************************************************/
+#define BEACON_REPEATS 5
+static double beaconPeriod;
+static unsigned long beaconNext;
+
+static void beaconAlarm(void)
+  {
+  queueStream(&queueSample);
+  sendQueued();
+  beaconNext += (unsigned long)(beaconPeriod * TIM_TICK_HZ);
+  setAlarm(beaconNext, beaconAlarm);
+  }
+
+static void beaconSetup(void)
+  {
+  beaconNext = timeNow() + (unsigned long)(beaconPeriod * TIM_TICK_HZ);
+  setAlarm(beaconNext, beaconAlarm);
+  }
+
+static void beaconMain(void)
+  {
+  bootBoard(beaconSetup);
+  for(;;)
+    asm("nop");
+  }
+
+static void printBeacon(void)
+  {
+  unsigned long nLed, i;
+  const SimEdge *led = simLedLog(&nLed);
+  int n = 0;
+
+  printf("  beacon every %.3f s (%lu ticks), starts vs. deadline:\n",
+         beaconPeriod, (unsigned long)(beaconPeriod * TIM_TICK_HZ));
+  for (i = 1; i < nLed; i++)
+    if (led[i].value == 0xF0)               // initChannels() of sendQueued()
+      {
+      double ideal = ++n * beaconPeriod * 1000.0;
+      printf("  %2d  %12.3f ms  %+9.3f ms\n", n, led[i].ms, led[i].ms - ideal);
+      }
+  }
+
+/********************************************************************************
+*  Scenario -f: one long tone, pitch averaged over the whole element
+********************************************************************************/
+static double pitchHz, pitchSeconds = 60.0;
+static const unsigned char pitchSymbols[] = { MORSE_PACK(SYM_DOT, 0, 0, 0) };
+static struct MorseStream pitchStream;
+
+static void pitchSetup(void)
+  {
+  initStream(&pitchStream);
+  }
+
+static void pitchMain(void)
+  {
+  pitchStream.format.dotTone = TONE_DHZ((unsigned long)(pitchHz * 10.0 + 0.5));
+  pitchStream.format.dotLEDs = dotLED;
+  pitchStream.format.timing.dotTicks = (unsigned long)(pitchSeconds * TIM_TICK_HZ);
+  pitchStream.format.timing.gapTicks = 1;
+  pitchStream.length = 1;
+  pitchStream.symbols = pitchSymbols;
+
+  bootBoard(pitchSetup);
+  sendCode();
+  for(;;)
+    asm("nop");
+  }
+
+static void printPitch(void)
+  {
+  unsigned long nSpk, s, rises = 0;
+  const SimEdge *spk = simSpeakerLog(&nSpk);
+  uint64_t first = 0, last = 0;
+  double hz;
+
+  for (s = 0; s < nSpk; s++)
+    if (spk[s].value)
+      {
+      if (!rises++)
+        first = spk[s].cycle;
+      last = spk[s].cycle;
+      }
+  hz = rises >= 2 ? (rises - 1) * simBusHz() / (double)(last - first) : 0;
+
+  printf("  %s: asked %.1f Hz, half-period %.4f ticks\n",
+         TONE_BACKEND == TONE_BACKEND_PWM ? "PWM backend, bus-cycle period" :
+         TONE_DITHER ? "output compare, dithered" : "output compare, whole ticks", pitchHz,
+         pitchStream.format.dotTone / 65536.0);
+  printf("  delivered %.4f Hz over %lu periods (%.1f s), error %+.4f Hz\n",
+         hz, rises - 1, (last - first) / simBusHz(), hz - pitchHz);
+  }
+
+/********************************************************************************
+*  Scenario -s: tone and button interrupts at once, lost flags
+********************************************************************************/
+#define STRESS_DOT_HZ   2000
+#define STRESS_DASH_HZ  1500
+static const struct MorseFormat stressFormat =
+  {
+  TONE_HZ(STRESS_DOT_HZ), TONE_HZ(STRESS_DASH_HZ), dotLED, LED34, MORSE_TIMING(20, 20, 30)
+  };
+static double stressSeconds;
+static unsigned long stressPresses[8], stressSeen[8];
+
+static char stressChar(void)
+  {
+  static const char *paris = "PARIS ";
+  static int i;
+  char c = paris[i];
+
+  i = (i + 1) % 6;
+  return c;
+  }
+
+// Counts every falling edge seen, acknowledged like the lab's SWx_ISR
+static void stressButton(int ch)
+  {
+  stressSeen[ch]++;
+  TIM_ACK(1 << ch);
+  }
+static void stressSW1(void) { stressButton(4); }
+static void stressSW2(void) { stressButton(5); }
+static void stressSW3(void) { stressButton(6); }
+static void stressSW4(void) { stressButton(7); }
+
+static void stressSetup(void)
+  {
+  initTextSource(&stressFormat, stressChar);
+  TCTL3 = 0xAA;                        // falling edges, as stopCode() sets up
+  TIE |= BUTTONS_M;
+  }
+
+static void stressMain(void)
+  {
+  bootBoard(stressSetup);
+  sendCode();
+  textLoop();
+  }
+
+// Presses 10..40 ms apart, held 5..15 ms, independently on each button
+static void stressButtons(void)
+  {
+  int ch;
+
+  srand(12345);
+  for (ch = 4; ch < 8; ch++)
+    {
+    double at = 5.0 + ch;
+
+    while (at < stressSeconds * 1000.0)
+      {
+      simPushButton(ch, at, 5.0 + rand() % 11);
+      stressPresses[ch]++;
+      at += 20.0 + rand() % 31;
+      }
+    }
+  }
+
+// Speaker half-periods at the pin against the exact ones, and SpeakerISR's wait
+#define STRESS_LED_LAG  200    // bus cycles from the element's compare to its LED change, at most
+static void printStressJitter(void)
+  {
+  unsigned long nLed, nSpk, i, s = 0, n = 0, late = 0, tones = 0;
+  const SimEdge *led = simLedLog(&nLed);
+  const SimEdge *spk = simSpeakerLog(&nSpk);
+  const SimWait *w = simIsrWait(SIM_VEC_TIMCH3);
+  double sumSq = 0, worst = 0, mean;
+
+  for (i = 0; i + 1 < nLed; i++)
+    {
+    double hz = led[i].value == dotLED ? STRESS_DOT_HZ : led[i].value == LED34 ? STRESS_DASH_HZ : 0;
+    double exact = hz > 0 ? simBusHz() / (2.0 * hz) : 0;
+    uint64_t prev = 0;
+    unsigned long edges = 0;
+
+    // from the edge at the compare that started the element, which is
+    // a little ahead of its LED change
+    for (; s < nSpk && spk[s].cycle + STRESS_LED_LAG < led[i + 1].cycle; s++)
+      {
+      if (spk[s].cycle + STRESS_LED_LAG < led[i].cycle || hz == 0)
+        continue;
+      edges++;
+      if (prev)
+        {
+        double dev = (double)(spk[s].cycle - prev) - exact;
+
+        sumSq += dev * dev;
+        if (fabs(dev) > fabs(worst))
+          worst = dev;
+        n++;
+        }
+      prev = spk[s].cycle;
+      }
+
+    // one edge short: the first half-period was doubled (or a later one lost)
+    if (hz > 0)
+      {
+      tones++;
+      if (edges + 1 < (unsigned long)((led[i + 1].cycle - led[i].cycle) / exact + 0.5))
+        late++;
+      }
+    }
+
+  printf("  HPRIO 0x%02X, nesting%s%s%s\n", ISR_HPRIO, ISR_NEST ? "" : " off",
+         (ISR_NEST & NEST_TONE) ? " toneDurationISR" : "", (ISR_NEST & NEST_ALARM) ? " alarmISR" : "");
+  printf("  speaker half-period vs exact, %lu periods: rms %.1f cycles, worst %+.0f cycles\n",
+         n, n ? sqrt(sumSq / n) : 0.0, worst);
+  printf("  tone elements one half-period short: %lu of %lu\n", late, tones);
+  if (w->count)
+    {
+    mean = (double)w->sum / w->count;
+    printf("  SpeakerISR wait, flag to body: mean %.1f, jitter (sd) %.1f, min %llu, max %llu cycles\n",
+           mean, sqrt(w->sumSquares / w->count - mean * mean),
+           (unsigned long long)w->min, (unsigned long long)w->max);
+    }
+  }
+
+static void printStress(void)
+  {
+  unsigned long nLed, nSpk, i, s = 0, elements = 0, silenced = 0;
+  const SimEdge *led = simLedLog(&nLed);
+  const SimEdge *spk = simSpeakerLog(&nSpk);
+  unsigned long pressed = 0, seen = 0;
+  int ch;
+
+  // a lost SpeakerISR leaves the rest of the element silent
+  for (i = 0; i + 1 < nLed; i++)
+    {
+    double hz = led[i].value == dotLED ? STRESS_DOT_HZ : led[i].value == LED34 ? STRESS_DASH_HZ : 0;
+    double expected = (led[i + 1].ms - led[i].ms) * 2.0 * hz / 1000.0;
+    unsigned long edges = 0;
+
+    for (; s < nSpk && spk[s].ms < led[i + 1].ms; s++)
+      if (spk[s].ms >= led[i].ms)
+        edges++;
+    if (hz > 0)
+      {
+      elements++;
+      if (edges + 2 < expected * 0.98)
+        silenced++;
+      }
+    }
+
+  printf("  %s flag acknowledgement, %.0f s of text at 20 WPM, %d/%d Hz tones\n",
+         TIM_FLAG_RMW ? "read-modify-write (TFLG1 |=)" : "exact (TFLG1 =)",
+         stressSeconds, STRESS_DOT_HZ, STRESS_DASH_HZ);
+  printf("  button   pressed   serviced   lost\n");
+  for (ch = 4; ch < 8; ch++)
+    {
+    printf("  SW%d    %8lu   %8lu %6lu\n", ch - 3, stressPresses[ch], stressSeen[ch],
+           stressPresses[ch] - stressSeen[ch]);
+    pressed += stressPresses[ch];
+    seen += stressSeen[ch];
+    }
+  printf("  all    %8lu   %8lu %6lu\n", pressed, seen, pressed - seen);
+  printf("  tone elements with a lost speaker interrupt: %lu of %lu\n", silenced, elements);
+  printStressJitter();
+  }
+
+/********************************************************************************
+*  Scenario -K: a straight key on SW4 decoded while text is being sent
+********************************************************************************/
+#define KEY_JITTER  10         // +- percent on every element and gap of the fist
+static const char *keyInput;
+static double keyWpm = 15, keyEndWpm;
+static char keyDecoded[256];
+static int nKeyDecoded;
+
+static double keyJitter(void)
+  {
+  return 1.0 + (rand() % (2 * KEY_JITTER + 1) - KEY_JITTER) / 100.0;
+  }
+
+// The input keyed through MORSE_ASCII, the speed going from keyWpm to keyEndWpm
+static void keyPresses(void)
+  {
+  int n = (int)strlen(keyInput), i, e;
+  double at = 500.0;
+
+  srand(4321);
+  for (i = 0; i < n; i++)
+    {
+    double wpm = keyWpm + (keyEndWpm - keyWpm) * i / (n > 1 ? n - 1 : 1);
+    double unit = 1200.0 / wpm;
+    char c = keyInput[i];
+    unsigned char code;
+
+    if (c == ' ')
+      {
+      at += 4 * unit * keyJitter();                 // 3 units of letter gap are behind
+      continue;
+      }
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    code = (c >= 0x20 && c < 0x60) ? MORSE_ASCII[c - 0x20] : 0;
+    if (code == 0)
+      continue;
+    for (e = 7; !(code & (1 << e)); e--)
+      ;
+    while (e--)
+      {
+      double mark = ((code & (1 << e)) ? 3 : 1) * unit * keyJitter();
+
+      simPushButton(7, at, mark);
+      at += mark + unit * keyJitter();
+      }
+    at += 2 * unit * keyJitter();
+    }
+  simSetLimit(at + 1500.0);
+  }
+
+static void keySetup(void)
+  {
+  initTextSource(&stressFormat, stressChar);
+  startKey(BUT_CH7_M);
+  }
+
+static void keyMain(void)
+  {
+  char c;
+
+  bootBoard(keySetup);
+  sendCode();
+  for(;;)
+    {
+#if EVENT_LOOP
+    switch (nextEvent())
+      {
+      case EVENT_TEXT: pumpText(); break;
+      case EVENT_KEY:  pumpKey();  break;
+      }
+#else
+    pumpText();
+    pumpKey();
+    asm("nop");
+#endif
+    while ((c = keyRead()) != 0)
+      if (nKeyDecoded < (int)sizeof keyDecoded - 1)
+        keyDecoded[nKeyDecoded++] = c;
+    }
+  }
+
+static void printKey(void)
+  {
+  printf("  straight key on SW4, %.0f to %.0f WPM, +-%d%% on every element and gap\n",
+         keyWpm, keyEndWpm, KEY_JITTER);
+  printf("  keyed:   %s\n", keyInput);
+  printf("  decoded: %s\n", keyDecoded);
+  printf("  speed estimate at the end: %u WPM\n", keyWPM());
+  printStressJitter();
+  }
+
+/********************************************************************************
+*  Scenarios -A / -R: the audio receiver on ATD0 while text is being sent
+********************************************************************************/
+#define AUDIO_HZ      8000     // synthesized audio
+#define AUDIO_LEVEL   0.25     // tone amplitude, of full scale
+#define AUDIO_RAMP_MS 5.0      // raised-cosine keying edges
+static const char *rxInput;    // text keyed into the audio, the reference of -R
+static double rxWpm = 20, rxSnrDb = 20, rxToneHz = RX_TONE_HZ;
+static const char *rxWavIn, *rxWavOut;
+static short *audio;           // the audio played into ATD0
+static long nAudio;
+static unsigned int audioRate;
+static char rxDecoded[512];
+static int nRxDecoded;
+
+extern struct RxBlock rxBlocks[RX_BLOCK_FIFO];
+extern volatile unsigned char rxBlockHead, rxBlockTail;
+
+static double gaussian(void)
+  {
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+  return sqrt(-2.0 * log(u)) * cos(6.283185307 * v);
+  }
+
+// rxInput keyed at rxWpm with the -K fist, as tone bursts in noise at rxSnrDb
+// (tone power over the noise power of the whole 4 kHz band)
+static void synthAudio(void)
+  {
+  int n = (int)strlen(rxInput), i, e;
+  double at = 500.0, unit = 1200.0 / rxWpm, sigma;
+  struct { double on, off; } marks[1024];
+  int nMarks = 0, m;
+  long k;
+
+  srand(2468);
+  for (i = 0; i < n; i++)
+    {
+    char c = rxInput[i];
+    unsigned char code;
+
+    if (c == ' ')
+      {
+      at += 4 * unit * keyJitter();
+      continue;
+      }
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    code = (c >= 0x20 && c < 0x60) ? MORSE_ASCII[c - 0x20] : 0;
+    if (code == 0)
+      continue;
+    for (e = 7; !(code & (1 << e)); e--)
+      ;
+    while (e-- && nMarks < 1024)
+      {
+      double mark = ((code & (1 << e)) ? 3 : 1) * unit * keyJitter();
+
+      marks[nMarks].on = at;
+      marks[nMarks++].off = at + mark;
+      at += mark + unit * keyJitter();
+      }
+    at += 2 * unit * keyJitter();
+    }
+
+  audioRate = AUDIO_HZ;
+  nAudio = (long)((at + 1500.0) * AUDIO_HZ / 1000.0);
+  audio = (short *)calloc(nAudio, sizeof *audio);
+  sigma = AUDIO_LEVEL / sqrt(2.0) / pow(10.0, rxSnrDb / 20.0);
+  for (k = 0, m = 0; k < nAudio; k++)
+    {
+    double t = k * 1000.0 / AUDIO_HZ, env = 0, v;
+
+    while (m < nMarks && marks[m].off + AUDIO_RAMP_MS < t)
+      m++;
+    if (m < nMarks && t > marks[m].on)
+      {
+      double up = (t - marks[m].on) / AUDIO_RAMP_MS, down = (marks[m].off + AUDIO_RAMP_MS - t) / AUDIO_RAMP_MS;
+
+      env = 1.0;
+      if (up < 1.0)
+        env = 0.5 - 0.5 * cos(3.14159265 * up);
+      else if (down < 1.0)
+        env = 0.5 - 0.5 * cos(3.14159265 * down);
+      }
+    v = AUDIO_LEVEL * env * sin(6.283185307 * rxToneHz * t / 1000.0) + sigma * gaussian();
+    v = v > 0.999 ? 0.999 : v < -1.0 ? -1.0 : v;
+    audio[k] = (short)(v * 32767.0);
+    }
+  }
+
+static unsigned long le(const unsigned char *p, int bytes)
+  {
+  unsigned long v = 0;
+
+  while (bytes--)
+    v = (v << 8) | p[bytes];
+  return v;
+  }
+
+// 8- or 16-bit PCM, first channel
+static int readWav(const char *path)
+  {
+  FILE *f = fopen(path, "rb");
+  unsigned char hdr[12], chunk[8], fmt[16];
+  unsigned int channels = 0, bits = 0;
+  unsigned long size;
+  long k;
+
+  if (!f || fread(hdr, 1, 12, f) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4))
+    return 0;
+  while (fread(chunk, 1, 8, f) == 8)
+    {
+    size = le(chunk + 4, 4);
+    if (!memcmp(chunk, "fmt ", 4) && size >= 16)
+      {
+      if (fread(fmt, 1, 16, f) != 16 || le(fmt, 2) != 1)
+        break;
+      channels = (unsigned int)le(fmt + 2, 2);
+      audioRate = (unsigned int)le(fmt + 4, 4);
+      bits = (unsigned int)le(fmt + 14, 2);
+      fseek(f, (long)(size - 16 + (size & 1)), SEEK_CUR);
+      }
+    else if (!memcmp(chunk, "data", 4) && channels && (bits == 8 || bits == 16))
+      {
+      unsigned int frame = channels * bits / 8;
+      unsigned char *raw = (unsigned char *)malloc(size);
+
+      nAudio = (long)(fread(raw, 1, size, f) / frame);
+      audio = (short *)malloc(nAudio * sizeof *audio);
+      for (k = 0; k < nAudio; k++)
+        audio[k] = bits == 16 ? (short)le(raw + k * frame, 2) : (short)((raw[k * frame] - 128) << 8);
+      free(raw);
+      fclose(f);
+      return audioRate > 0;
+      }
+    else
+      fseek(f, (long)(size + (size & 1)), SEEK_CUR);
+    }
+  fclose(f);
+  return 0;
+  }
+
+static void writeWav(const char *path)
+  {
+  FILE *f = fopen(path, "wb");
+  unsigned long bytes = (unsigned long)nAudio * 2;
+  unsigned char hdr[44] = { 'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ',
+                            16, 0, 0, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 16, 0,
+                            'd', 'a', 't', 'a' };
+  int i;
+  long k;
+
+  for (i = 0; i < 4; i++)
+    {
+    hdr[4 + i] = (unsigned char)((36 + bytes) >> (8 * i));
+    hdr[24 + i] = (unsigned char)(audioRate >> (8 * i));
+    hdr[28 + i] = (unsigned char)((audioRate * 2UL) >> (8 * i));
+    hdr[40 + i] = (unsigned char)(bytes >> (8 * i));
+    }
+  if (!f)
+    return;
+  fwrite(hdr, 1, 44, f);
+  for (k = 0; k < nAudio; k++)
+    {
+    unsigned char b[2] = { (unsigned char)audio[k], (unsigned char)(audio[k] >> 8) };
+
+    fwrite(b, 1, 2, f);
+    }
+  fclose(f);
+  }
+
+// The audio at a time, linearly interpolated, 0..1 of VRH around mid-scale
+static double audioAt(double ms)
+  {
+  double x = ms * audioRate / 1000.0;
+  long k = (long)x;
+
+  if (k < 0 || k + 1 >= nAudio)
+    return 0.5;
+  return 0.5 + (audio[k] + (x - k) * (audio[k + 1] - audio[k])) / 65536.0;
+  }
+
+static void rxSetup(void)
+  {
+  initTextSource(&stressFormat, stressChar);
+  startReceiver();
+  }
+
+static void rxMain(void)
+  {
+  char c;
+
+  bootBoard(rxSetup);
+  sendCode();
+  for(;;)
+    {
+#if EVENT_LOOP
+    switch (nextEvent())
+      {
+      case EVENT_TEXT: pumpText(); break;
+      case EVENT_RX:   pumpReceiver(); pumpKey(); break;
+      case EVENT_KEY:  pumpKey(); break;
+      }
+#else
+    pumpText();
+    pumpReceiver();
+    pumpKey();
+    asm("nop");
+#endif
+    while ((c = keyRead()) != 0)
+      if (nRxDecoded < (int)sizeof rxDecoded - 1)
+        rxDecoded[nRxDecoded++] = c;
+    }
+  }
+
+// Edit distance over the reference, both without leading/trailing spaces
+static double charErrorRate(const char *ref, const char *got)
+  {
+  static int row[512 + 1];
+  int n, m, i, j;
+
+  while (*ref == ' ')
+    ref++;
+  while (*got == ' ')
+    got++;
+  n = (int)strlen(ref);
+  m = (int)strlen(got);
+  while (n && ref[n - 1] == ' ')
+    n--;
+  while (m && got[m - 1] == ' ')
+    m--;
+  if (m > 512)
+    m = 512;
+  for (j = 0; j <= m; j++)
+    row[j] = j;
+  for (i = 1; i <= n; i++)
+    {
+    int diag = row[0];
+
+    row[0] = i;
+    for (j = 1; j <= m; j++)
+      {
+      int up = row[j];
+      int sub = diag + (toupper((unsigned char)ref[i - 1]) != got[j - 1]);
+
+      row[j] = sub < up + 1 ? sub : up + 1;
+      if (row[j - 1] + 1 < row[j])
+        row[j] = row[j - 1] + 1;
+      diag = up;
+      }
+    }
+  return n ? (double)row[m] / n : 0;
+  }
+
+static inline uint64_t hostCycles(void)
+  {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int lo, hi;
+
+  __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+#else
+  return 0;
+#endif
+  }
+
+// The lab's Goertzel kernel (rxFilter, rxPower per block) over the audio
+// resampled to the receiver's rate, on the host
+static void benchKernel(void)
+  {
+  double fs = (double)TIM_TICK_HZ / RX_SAMPLE_TICKS;
+  long n = (long)((double)nAudio * fs / audioRate), k;
+  int *x = (int *)malloc(n * sizeof *x), pass, passes = 50;
+  volatile unsigned long sink = 0;
+  uint64_t cycles;
+  struct timespec t0, t1;
+  double ns;
+
+  for (k = 0; k < n; k++)
+    x[k] = (int)(audioAt(k * 1000.0 / fs) * 256.0) - 0x80;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  cycles = hostCycles();
+  for (pass = 0; pass < passes; pass++)
+    for (k = 0; k < n; k++)
+      if (rxFilter(x[k]))
+        {
+        sink += rxPower(&rxBlocks[rxBlockTail & RX_BLOCK_MASK]);
+        rxBlockTail++;
+        }
+  cycles = hostCycles() - cycles;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+  printf("  host kernel: %ld samples x %d, %.2f ns/sample", n, passes, ns / ((double)n * passes));
+  if (cycles)
+    printf(", %.1f host cycles/sample", (double)cycles / ((double)n * passes));
+  printf("\n");
+  free(x);
+  }
+
+static void printRx(void)
+  {
+  double fs = (double)TIM_TICK_HZ / RX_SAMPLE_TICKS;
+
+  if (rxWavIn)
+    printf("  audio: %s, %ld samples at %u Hz\n", rxWavIn, nAudio, audioRate);
+  else
+    printf("  audio: %.0f WPM at %.0f Hz, SNR %.0f dB in 4 kHz, +-%d%% fist\n",
+           rxWpm, rxToneHz, rxSnrDb, KEY_JITTER);
+  printf("  receiver: %d Hz bin, %.1f Hz sampling (%u ticks), %d-sample blocks\n",
+         RX_TONE_HZ, fs, RX_SAMPLE_TICKS, RX_BLOCK);
+  if (rxInput)
+    printf("  keyed:   %s\n", rxInput);
+  printf("  decoded: %s\n", rxDecoded);
+  if (rxInput)
+    printf("  character error rate: %.1f%%\n", 100.0 * charErrorRate(rxInput, rxDecoded));
+  printf("  speed estimate at the end: %u WPM\n", keyWPM());
+  if (simIsrCount(SIM_VEC_TIMCH2))
+    printf("  rxSampleISR: %.1f bus cycles/sample (register model, entry and RTI)\n",
+           (double)simIsrCycles(SIM_VEC_TIMCH2) / simIsrCount(SIM_VEC_TIMCH2));
+  printStressJitter();
+  benchKernel();
+  }
+
+/********************************************************************************
+*  Scenario -P: iambic keyer, dit paddle on SW1 and dah paddle on SW2 (-p 4/-p 5)
+********************************************************************************/
+#define KEYER_HZ   700
+#define KEYER_WPM  20
+static const struct MorseFormat keyerFmt =
+  {
+  TONE_HZ(KEYER_HZ), TONE_HZ(KEYER_HZ), LED4, LED34, MORSE_TIMING(KEYER_WPM, KEYER_WPM, 30)
+  };
+static int keyerMode = -1;
+static double paddleAt[16];
+static int nPaddle;
+
+static void keyerSetup(void)
+  {
+  startKeyer(&keyerFmt, BUT_CH4_M, BUT_CH5_M, (unsigned char)keyerMode);
+  }
+
+static void keyerMain(void)
+  {
+  bootBoard(keyerSetup);
+  for(;;)
+    asm("nop");
+  }
+
+static void printKeyer(void)
+  {
+  unsigned long nLed, nSpk, i, s = 0;
+  const SimEdge *led = simLedLog(&nLed);
+  const SimEdge *spk = simSpeakerLog(&nSpk);
+  double worst = 0;
+  int p;
+
+  printf("  iambic %c keyer, %d WPM, %d Hz sidetone, dit paddle SW1, dah paddle SW2\n",
+         keyerMode == KEYER_IAMBIC_B ? 'B' : 'A', KEYER_WPM, KEYER_HZ);
+  printf("  keyed:");
+  for (i = 0; i < nLed; i++)
+    if (led[i].value == LED4 || led[i].value == LED34)
+      printf(" %c@%.0f", led[i].value == LED4 ? '.' : '-', led[i].ms);
+  printf("\n");
+
+  // A press with the keyer idle starts it at once, initChannels() writing
+  // 0xF0 to PTM within the ISR; the others are taken at the end of a gap
+  printf("  paddle edge to first sidetone edge, keyer idle:\n");
+  for (p = 0; p < nPaddle; p++)
+    {
+    for (i = 0; i < nLed && led[i].ms < paddleAt[p]; i++)
+      ;
+    if (i == nLed || led[i].value != 0xF0 || led[i].ms > paddleAt[p] + 1.0)
+      continue;
+    for (s = 0; s < nSpk && spk[s].ms < paddleAt[p]; s++)
+      ;
+    if (s == nSpk)
+      {
+      printf("    %9.3f ms: no sidetone\n", paddleAt[p]);
+      continue;
+      }
+    printf("    %9.3f ms: %7.1f us\n", paddleAt[p], (spk[s].ms - paddleAt[p]) * 1000.0);
+    if (spk[s].ms - paddleAt[p] > worst)
+      worst = spk[s].ms - paddleAt[p];
+    }
+  printf("  worst: %.1f us%s\n", worst * 1000.0, worst < 1.0 ? "" : "  (over 1 ms)");
+  }
+
+/********************************************************************************
+*  ISR_PROFILE builds: the lab's instrumentation table, dumped over SCI0
+********************************************************************************/
+/********************************************************************************
+*  Scenario -W: software timers on the one alarm compare, each re-armed from
+*  its own callback at a random period of 1 ms up, while text is being sent
+********************************************************************************/
+#define WHEEL_MAX  1024
+struct WheelTimer
+  {
+  struct Timer  timer;               // first: the callback's struct Timer *
+  unsigned long period;
+  unsigned long start;               // timeNow() when first started
+  unsigned long expiries;
+  };
+static struct WheelTimer wheel[WHEEL_MAX];
+static int wheelTimers;
+static double wheelMaxMs = 1000.0;
+static unsigned long wheelExpiries;
+static long wheelLateMin, wheelLateMax;
+static double wheelLateSum;
+
+static void wheelExpired(struct Timer *timer)
+  {
+  struct WheelTimer *w = (struct WheelTimer *)timer;
+  long late = (long)(timeNow() - timer->deadline);
+
+  if (!wheelExpiries++ || late < wheelLateMin)
+    wheelLateMin = late;
+  if (wheelExpiries == 1 || late > wheelLateMax)
+    wheelLateMax = late;
+  wheelLateSum += late;
+  w->expiries++;
+  startTimer(timer, timer->deadline + w->period, wheelExpired);
+  }
+
+static void wheelSetup(void)
+  {
+  unsigned long now;
+  int i;
+
+  srand(2323);
+  now = timeNow();
+  for (i = 0; i < wheelTimers; i++)
+    {
+    wheel[i].period = (unsigned long)((1.0 + (wheelMaxMs - 1.0) * rand() / RAND_MAX) * TIM_TICK_HZ / 1000.0);
+    wheel[i].start = now;
+    startTimer(&wheel[i].timer, now + wheel[i].period, wheelExpired);
+    }
+  initTextSource(&stressFormat, stressChar);
+  }
+
+static void wheelMain(void)
+  {
+  bootBoard(wheelSetup);
+  sendCode();
+  textLoop();
+  }
+
+// timerRemove() + timerInsert() of each timer into the wheel holding all the
+// others, on the host. timerRunning keeps them off ALARM_TC (no register
+// access once the run is over), so this is the list and slot work alone.
+extern unsigned char timerRunning;
+
+static void benchWheel(void)
+  {
+  int i, passes = 200, pass;
+  unsigned long base = wheel[0].timer.deadline;
+  uint64_t cycles;
+  struct timespec t0, t1;
+  double ns, n = (double)passes * wheelTimers;
+
+  timerRunning = 1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  cycles = hostCycles();
+  for (pass = 0; pass < passes; pass++)
+    for (i = 0; i < wheelTimers; i++)
+      {
+      timerRemove(&wheel[i].timer);
+      timerInsert(&wheel[i].timer, base + wheel[(i + pass) % wheelTimers].period, wheelExpired);
+      }
+  cycles = hostCycles() - cycles;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+  printf("  host: %.1f ns", ns / n);
+  if (cycles)
+    printf(", %.1f host cycles", (double)cycles / n);
+  printf(" per timerRemove() + timerInsert(), %d timers in the wheel\n", wheelTimers);
+  }
+
+static void printWheel(void)
+  {
+  unsigned long calls = simIsrCount(SIM_VEC_TIMCH1);
+  double us = 1e6 / TIM_TICK_HZ, end = simMs() * TIM_TICK_HZ / 1000.0;
+  int i, off = 0;
+
+  // each timer's expiries against its own schedule, within one either way
+  // of the end of the run (timeNow() and simMs() start a few us apart)
+  for (i = 0; i < wheelTimers; i++)
+    if (fabs((end - wheel[i].start) / wheel[i].period - wheel[i].expiries) > 1.0)
+      off++;
+
+  printf("  %d timers, periods up to %.0f ms, on ALARM_TC: %lu expiries, %lu alarmISR calls"
+         " (%.3f per expiry)\n", wheelTimers, wheelMaxMs, wheelExpiries, calls,
+         wheelExpiries ? (double)calls / wheelExpiries : 0.0);
+  printf("  timers off their schedule: %d\n", off);
+  if (wheelExpiries)
+    {
+    printf("  callback late by: min %.0f us, mean %.1f us, max %.0f us (ticks of %.0f us)\n",
+           wheelLateMin * us, wheelLateSum / wheelExpiries * us, wheelLateMax * us, us);
+    printf("  alarmISR: %.1f bus cycles per expiry (register model, entry and RTI)\n",
+           (double)simIsrCycles(SIM_VEC_TIMCH1) / wheelExpiries);
+    }
+  printStressJitter();
+  benchWheel();
+  }
+
+/********************************************************************************
+*  Scenario -L: up to four texts at once, each on its own LED at its own speed
+********************************************************************************/
+static const char *laneText[LANE_COUNT];
+static int laneWpm[LANE_COUNT];
+static int laneCount;
+
+static void laneSetup(void)
+  {
+  int i;
+
+  for (i = 0; i < laneCount; i++)
+    startLane((unsigned char)i, laneText[i], (unsigned char)laneWpm[i]);
+  }
+
+static void laneMain(void)
+  {
+  bootBoard(laneSetup);
+  for(;;)
+    asm("nop");
+  }
+
+// The text of a lane back from its LED, element lengths against its own unit
+static void decodeLane(int lane, const SimEdge *led, unsigned long nLed, double unitMs,
+                       char *out, int size)
+  {
+  unsigned char bit = LED1 >> lane, code = 1, last = 0;
+  double since = 0;
+  unsigned long i;
+  int n = 0, c;
+
+  for (i = 0; i < nLed && n < size - 2; i++)
+    {
+    unsigned char on = (led[i].value & bit) != 0;
+    double units;
+
+    if (on == last)
+      continue;
+    units = (led[i].ms - since) / unitMs;
+    if (on && since > 0 && units >= 2.0)
+      {
+      // a letter or word gap ends the character
+      for (c = 0; c < 64 && MORSE_ASCII[c] != code; c++)
+        ;
+      out[n++] = c < 64 ? (char)(c + 0x20) : '?';
+      if (units >= 5.0 && n < size - 2)
+        out[n++] = ' ';
+      code = 1;
+      }
+    else if (!on)
+      code = (unsigned char)(code << 1 | (units >= 2.0));
+    since = led[i].ms;
+    last = on;
+    }
+  if (code != 1)
+    {
+    for (c = 0; c < 64 && MORSE_ASCII[c] != code; c++)
+      ;
+    out[n++] = c < 64 ? (char)(c + 0x20) : '?';
+    }
+  out[n] = 0;
+  }
+
+// Worst distance of a lane's LED edges from where its timing puts them,
+// counted from its first mark; the edges are computed as laneAdvance() does
+static double laneError(int lane, const SimEdge *led, unsigned long nLed, unsigned long *edges)
+  {
+  unsigned char bit = LED1 >> lane, last = 0;
+  double tick = simBusHz() / TIM_TICK_HZ, first = -1, worst = 0;
+  unsigned long unitTicks = MORSE_UNIT(laneWpm[lane]);
+  unsigned long dashTicks = MORSE_DASH(laneWpm[lane], MORSE_DASH_WEIGHT);
+  unsigned long letterTicks = MORSE_LETTER(laneWpm[lane], laneWpm[lane]);
+  unsigned long wordTicks = MORSE_WORD(laneWpm[lane], laneWpm[lane]);
+  unsigned long ideal = 0, i;
+  const char *p = laneText[lane];
+  unsigned char code = 0, elements = 0, gap = 0, on = 0;
+
+  *edges = 0;
+  for (i = 0; i < nLed; i++)
+    {
+    double at;
+
+    if (((led[i].value & bit) != 0) == last)
+      continue;
+    last = !last;
+    if (first < 0)
+      first = (double)led[i].cycle;
+    at = (led[i].cycle - first) / tick;
+    if (fabs(at - ideal) > worst)
+      worst = fabs(at - ideal);
+    (*edges)++;
+
+    // the next ideal edge
+    if (!on)
+      {
+      while (!elements && *p)
+        {
+        char c = (char)toupper((unsigned char)*p++);
+
+        if (c == ' ')
+          gap = 2;
+        else if (c >= 0x20 && c < 0x60 && MORSE_ASCII[c - 0x20])
+          {
+          code = MORSE_ASCII[c - 0x20];
+          for (elements = 7; !(code & (1 << elements)); elements--)
+            ;
+          }
+        }
+      elements--;
+      ideal += (code & (1 << elements)) ? dashTicks : unitTicks;
+      on = 1;
+      }
+    else
+      {
+      on = 0;
+      if (elements)
+        ideal += unitTicks;
+      else
+        {
+        gap = 1;
+        for (; *p == ' ' || (*p && !MORSE_ASCII[(toupper((unsigned char)*p) - 0x20) & 63]); p++)
+          if (*p == ' ')
+            gap = 2;
+        ideal += gap == 2 ? wordTicks : letterTicks;
+        }
+      }
+    }
+  return worst * 1e6 / TIM_TICK_HZ;
+  }
+
+static void printLanes(void)
+  {
+  unsigned long nLed, edges, transitions = 0;
+  const SimEdge *led = simLedLog(&nLed);
+  unsigned long calls = simIsrCount(SIM_VEC_TIMCH1);
+  char decoded[512];
+  int i;
+
+  for (i = 0; i < laneCount; i++)
+    {
+    double error = laneError(i, led, nLed, &edges);
+
+    decodeLane(i, led, nLed, MORSE_UNIT(laneWpm[i]) * 1000.0 / TIM_TICK_HZ, decoded, sizeof decoded);
+    printf("  lane %d, LED 0x%02X, %2d wpm: \"%s\"\n", i, LED1 >> i, laneWpm[i], decoded);
+    printf("          %lu transitions, worst %.0f us from its timing\n", edges, error);
+    transitions += edges;
+    }
+  if (calls && transitions)
+    printf("  %d lanes: %lu alarmISR calls (one PTM store each) for %lu transitions,\n"
+           "           %.1f bus cycles per call, %.1f per transition\n", laneCount, calls, transitions,
+           (double)simIsrCycles(SIM_VEC_TIMCH1) / calls,
+           (double)simIsrCycles(SIM_VEC_TIMCH1) / transitions);
+  }
+
+/********************************************************************************
+*  Boot time: main() to the first speaker compare, with the PLL lock modelled
+********************************************************************************/
+static int bootReport;
+static double pllLockUs;
+
+static void printBoot(void)
+  {
+  unsigned long nSpk;
+  const SimEdge *spk = simSpeakerLog(&nSpk);
+
+  if (pllLockUs < 0)
+    printf("\n  PLL never locking: ");
+  else
+    printf("\n  PLL locking %.0f us after PLLON: ", pllLockUs);
+  printf("%s, bus %.1f MHz\n", clockFallback ? "crystal fallback" : "PLL selected", simBusHz() / 1e6);
+  if (nSpk)
+    printf("  main() to the first SPEAKER_TC compare: %.3f ms (%llu bus cycles)\n",
+           spk[0].ms, (unsigned long long)spk[0].cycle);
+  else
+    printf("  no speaker compare\n");
+  }
+
+#if ISR_PROFILE
+static void profileDumpMain(void)
+  {
+  // quiet the timer first, so the dump itself isn't measured
+  TIE = 0x00;
+  TSCR2 = TIM_PRESCALER;
+  initSCI();
+  dumpIsrStats(sciPutChar);
+  }
+
+static void printIsrProfile(void)
+  {
+  simSetLimit(simMs() + 10000.0);
+  simRun(profileDumpMain);
+  printf("\n  isrStats[] over SCI0 (cycles from ISR_ENTER to ISR_EXIT, latency in TIM ticks):\n");
+  fputs(simSciOutput(), stdout);
+  }
+#endif
+
+static void usage(void)
+  {
+  fprintf(stderr, "usage: lab1sim [-o osc_MHz] [-t limit_ms] [-l latency_cycles]\n"
+                  "               [-p channel:at_ms[:hold_ms]]... [-d symbols] [-m text]\n"
+                  "               [-q messages | -r messages] [-w wpm[:fwpm[:dash_weight]]]\n"
+                  "               [-b beacon_period_s] [-f freq_Hz[:seconds]] [-s seconds]\n"
+                  "               [-c vector:cycles]... [-k pll_lock_us] [-n bounce_ms[:glitches]]\n"
+                  "               [-K text[:wpm[:end_wpm]]] [-P A|B]\n"
+                  "               [-A text[:wpm[:snr_dB[:tone_Hz]]] [-O out.wav] | -R in.wav[:text]]\n"
+                  "               [-W timers[:max_period_ms]] [-L text[:wpm]]...\n");
+  exit(2);
+  }
+
+int main(int argc, char **argv)
+  {
+  double oscMHz = OSC_HZ / 1e6, limitMs = 60000.0;
+  unsigned int latency = 0;
+  double bounceMs = 0;
+  int bounceGlitches = 3;
+  clock_t wall;
+  int i, status;
+
+  // Button presses are collected first, the model is reset before adding them
+  struct { int ch; double at, hold; } press[16];
+  int nPress = 0;
+  struct { int vec; unsigned int cycles; } work[SIM_NUM_VECTORS];
+  int nWork = 0;
+
+  for (i = 1; i < argc; i++)
+    {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc)
+      oscMHz = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+      limitMs = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+      latency = (unsigned int)atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-p") && i + 1 < argc && nPress < 16)
+      {
+      press[nPress].hold = 50.0;
+      if (sscanf(argv[++i], "%d:%lf:%lf", &press[nPress].ch, &press[nPress].at,
+                 &press[nPress].hold) < 2 || press[nPress].ch < 4 || press[nPress].ch > 7)
+        usage();
+      nPress++;
+      }
+    else if (!strcmp(argv[i], "-K") && i + 1 < argc)
+      {
+      static char keyArg[256];
+      char *colon;
+
+      strncpy(keyArg, argv[++i], sizeof keyArg - 1);
+      keyInput = keyArg;
+      keyEndWpm = 0;
+      if ((colon = strchr(keyArg, ':')) != NULL)
+        {
+        *colon = 0;
+        if (sscanf(colon + 1, "%lf:%lf", &keyWpm, &keyEndWpm) < 1 || keyWpm < 1)
+          usage();
+        }
+      if (keyEndWpm < 1)
+        keyEndWpm = keyWpm;
+      }
+    else if (!strcmp(argv[i], "-A") && i + 1 < argc)
+      {
+      static char rxArg[512];
+      char *colon;
+
+      strncpy(rxArg, argv[++i], sizeof rxArg - 1);
+      rxInput = rxArg;
+      if ((colon = strchr(rxArg, ':')) != NULL)
+        {
+        *colon = 0;
+        if (sscanf(colon + 1, "%lf:%lf:%lf", &rxWpm, &rxSnrDb, &rxToneHz) < 1 || rxWpm < 1)
+          usage();
+        }
+      }
+    else if (!strcmp(argv[i], "-W") && i + 1 < argc)
+      {
+      if (sscanf(argv[++i], "%d:%lf", &wheelTimers, &wheelMaxMs) < 1 || wheelTimers < 1 ||
+          wheelTimers > WHEEL_MAX || wheelMaxMs < 1)
+        usage();
+      limitMs = 10000.0;
+      }
+    else if (!strcmp(argv[i], "-L") && i + 1 < argc && laneCount < LANE_COUNT)
+      {
+      static char laneArg[LANE_COUNT][256];
+      char *colon;
+
+      strncpy(laneArg[laneCount], argv[++i], sizeof laneArg[0] - 1);
+      laneText[laneCount] = laneArg[laneCount];
+      laneWpm[laneCount] = MORSE_WPM;
+      if ((colon = strchr(laneArg[laneCount], ':')) != NULL)
+        {
+        *colon = 0;
+        if (sscanf(colon + 1, "%d", &laneWpm[laneCount]) != 1 || laneWpm[laneCount] < 1 ||
+            laneWpm[laneCount] > 255)
+          usage();
+        }
+      laneCount++;
+      }
+    else if (!strcmp(argv[i], "-O") && i + 1 < argc)
+      rxWavOut = argv[++i];
+    else if (!strcmp(argv[i], "-R") && i + 1 < argc)
+      {
+      static char wavArg[512];
+      char *colon;
+
+      strncpy(wavArg, argv[++i], sizeof wavArg - 1);
+      rxWavIn = wavArg;
+      if ((colon = strchr(wavArg, ':')) != NULL)
+        {
+        *colon = 0;
+        rxInput = colon + 1;
+        }
+      }
+    else if (!strcmp(argv[i], "-P") && i + 1 < argc)
+      {
+      i++;
+      if (!strcmp(argv[i], "A"))
+        keyerMode = KEYER_IAMBIC_A;
+      else if (!strcmp(argv[i], "B"))
+        keyerMode = KEYER_IAMBIC_B;
+      else
+        usage();
+      }
+    else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+      {
+      if (sscanf(argv[++i], "%lf:%d", &bounceMs, &bounceGlitches) < 1 || bounceMs < 0 ||
+          bounceGlitches < 1)
+        usage();
+      }
+    else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+      {
+      driftSymbols = atoi(argv[++i]);
+      if (driftSymbols < 1 || driftSymbols > MAX_DRIFT_SYMBOLS)
+        usage();
+      limitMs = 1e9;
+      }
+    else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+      text = argv[++i];
+    else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+      {
+      if (sscanf(argv[++i], "%d:%d:%d", &wpm, &fwpm, &dashWeight) < 1 || wpm < 1)
+        usage();
+      if (fwpm < 1)
+        fwpm = wpm;
+      }
+    else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+      {
+      if (sscanf(argv[++i], "%lf:%lf", &pitchHz, &pitchSeconds) < 1 ||
+          pitchHz < 20.0 || pitchHz > 5000.0 || pitchSeconds <= 0)
+        usage();
+      limitMs = pitchSeconds * 1000.0 + 1000.0;
+      }
+    else if (!strcmp(argv[i], "-c") && i + 1 < argc && nWork < SIM_NUM_VECTORS)
+      {
+      if (sscanf(argv[++i], "%d:%u", &work[nWork].vec, &work[nWork].cycles) != 2 ||
+          work[nWork].vec < 0 || work[nWork].vec >= SIM_NUM_VECTORS)
+        usage();
+      nWork++;
+      }
+    else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+      {
+      pllLockUs = atof(argv[++i]);
+      bootReport = 1;
+      }
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      {
+      stressSeconds = atof(argv[++i]);
+      if (stressSeconds <= 0 || stressSeconds > 3600.0)
+        usage();
+      limitMs = stressSeconds * 1000.0;
+      }
+    else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+      {
+      beaconPeriod = atof(argv[++i]);
+      if (beaconPeriod < 5.0 || beaconPeriod > 60000.0)
+        usage();
+      limitMs = (BEACON_REPEATS + 0.5) * beaconPeriod * 1000.0;
+      }
+    else if ((!strcmp(argv[i], "-q") || !strcmp(argv[i], "-r")) && i + 1 < argc)
+      {
+      int n = atoi(argv[i + 1]);
+
+      if (n < 1)
+        usage();
+      if (argv[i][1] == 'q')
+        queueMessages = n;
+      else
+        restartMessages = n;
+      i++;
+      limitMs = 1e9;
+      }
+    else
+      usage();
+    }
+
+  simReset(oscMHz * 1e6);
+  simSetLimit(limitMs);
+  simSetIsrLatency(latency);
+  simSetPllLock(bootReport ? pllLockUs : 0);
+  for (i = 0; i < nWork; i++)
+    simSetIsrWork(work[i].vec, work[i].cycles);
+  if (bounceMs > 0)
+    simSetBounce(bounceMs, bounceGlitches);
+  for (i = 0; i < nPress; i++)
+    {
+    simPushButton(press[i].ch, press[i].at, press[i].hold);
+    if (press[i].ch == 4 || press[i].ch == 5)
+      paddleAt[nPaddle++] = press[i].at;
+    }
+  bindVectors();
+  if (keyInput)
+    keyPresses();
+  if (rxWavIn || rxInput)
+    {
+    if (rxWavIn && !readWav(rxWavIn))
+      {
+      fprintf(stderr, "lab1sim: can't read %s as PCM WAV\n", rxWavIn);
+      return 2;
+      }
+    if (!rxWavIn)
+      synthAudio();
+    if (rxWavOut)
+      writeWav(rxWavOut);
+    simSetAnalog(audioAt);
+    simSetLimit((double)nAudio * 1000.0 / audioRate);
+    }
+  if (stressSeconds > 0)
+    {
+    stressButtons();
+    simSetVector(SIM_VEC_TIMCH4, stressSW1);
+    simSetVector(SIM_VEC_TIMCH5, stressSW2);
+    simSetVector(SIM_VEC_TIMCH6, stressSW3);
+    simSetVector(SIM_VEC_TIMCH7, stressSW4);
+    }
+
+  wall = clock();
+  status = simRun(driftSymbols ? driftMain : wheelTimers ? wheelMain : laneCount ? laneMain : text ? textMain :
+                  (queueMessages || restartMessages) ? queueMain :
+                  beaconPeriod > 0 ? beaconMain :
+                  pitchHz > 0 ? pitchMain :
+                  stressSeconds > 0 ? stressMain :
+                  keyInput ? keyMain :
+                  keyerMode >= 0 ? keyerMain :
+                  (rxWavIn || rxInput) ? rxMain : lab1_main);
+  wall = clock() - wall;
+
+  if (driftSymbols)
+    printDrift();
+  else if (wheelTimers)
+    printWheel();
+  else if (laneCount)
+    printLanes();
+  else if (queueMessages || restartMessages)
+    printQueueGaps();
+  else if (beaconPeriod > 0)
+    printBeacon();
+  else if (pitchHz > 0)
+    printPitch();
+  else if (stressSeconds > 0)
+    printStress();
+  else if (keyInput)
+    printKey();
+  else if (keyerMode >= 0)
+    printKeyer();
+  else if (rxWavIn || rxInput)
+    printRx();
+  else
+    printTimeline();
+  printIsrLoad();
+  printIdle();
+  if (bootReport)
+    printBoot();
+#if ISR_PROFILE
+  printIsrProfile();
+#endif
+  printf("\n  simulated %.3f ms (%llu bus cycles at %.1f MHz) in %.0f us of host time\n",
+         simMs(), (unsigned long long)simCycles(), simBusHz() / 1e6,
+         wall * 1e6 / CLOCKS_PER_SEC);
+  return status;
+  }
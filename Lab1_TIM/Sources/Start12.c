@@ -29,6 +29,22 @@ Note: C++ destructors of global objects are NOT yet supported in the HIWARE Obje
 /* #define _DO_ENABLE_COP_: do enable the COP                              */
 /* #define _DO_DISABLE_COP_: disable the COP                               */
 /* Without defining any of these, the startup code does NOT handle the COP */
+/***************************************************************************/
+/* _FAST_BOOT_ define:                                                     */
+/* Zero out and copy down a word at a time (the __OPTIMIZE_FOR_TIME__      */
+/* loops) even when the project is compiled for size (-os), where they     */
+/* would otherwise go a byte at a time. The time from reset to main is     */
+/* dead air for a beacon coming back from a brown-out.                     */
+/* On by default; -D_FAST_BOOT_=0 selects the original byte loops.         */
+/***************************************************************************/
+#ifndef _FAST_BOOT_
+#define _FAST_BOOT_ 1
+#endif
+
+#if defined(__OPTIMIZE_FOR_SIZE__) && !_FAST_BOOT_
+#define __BYTE_INIT_LOOPS__
+#endif
+
 /***************************************************************************/
 /* __ONLY_INIT_SP define:                                                  */
 /* This define selects an shorter version of the startup code              */
@@ -166,7 +182,7 @@ NextZeroOut: PSHY                           ; save nofZeroOuts
 #if defined(__HCS12X__) && defined(FAR_DATA)
              PSHX
              LDX   0,X                      ; byte count
-#if defined(__OPTIMIZE_FOR_SIZE__)
+#if defined(__BYTE_INIT_LOOPS__)
              CLRA
 NextWord:    GSTAA 1,Y+                     ; clear memory byte
              __FEED_COP_IN_HLI()            ; feed the COP if necessary /*lint !e505 !e522 asm code */
@@ -185,7 +201,7 @@ LastClr:
 #endif
              PULX
              LEAX  2,X
-#elif defined(__OPTIMIZE_FOR_SIZE__)               /* -os, default */
+#elif defined(__BYTE_INIT_LOOPS__)               /* -os, default */
              LDD   2,X+                     ; byte count
 NextWord:    CLR   1,Y+                     ; clear memory byte
              __FEED_COP_IN_HLI()            ; feed the COP if necessary /*lint !e505 !e522 asm code */
@@ -236,7 +252,7 @@ NextBlock:
 #endif /* FAR_DATA */
 
 #if defined(__HCS12X__) && defined(FAR_DATA)
-#if defined(__OPTIMIZE_FOR_SIZE__)               /* -os, default */
+#if defined(__BYTE_INIT_LOOPS__)               /* -os, default */
 Copy:        PSHA
              LDAA  1,X+
              GSTAA  1,Y+                    ; move a byte from ROM to the data area
@@ -258,7 +274,7 @@ Copy1:
              LDAA  1,X+
              GSTAA  1,Y+                    ; move a byte from ROM to the data area
 #endif
-#elif defined(__OPTIMIZE_FOR_SIZE__)               /* -os, default */
+#elif defined(__BYTE_INIT_LOOPS__)               /* -os, default */
 Copy:        MOVB  1,X+,1,Y+                ; move a byte from ROM to the data area
              __FEED_COP_IN_HLI()            ; feed the COP if necessary /*lint !e505 !e522 asm code */
              DBNE  D,Copy                   ; copy-byte loop
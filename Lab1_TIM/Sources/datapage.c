@@ -788,12 +788,26 @@ done:
   - the function returns after the constant defining the number of bytes to be copied
 
 
-  stack-structure at the loop-label:
-     0,SP : destination offset
-     2,SP : source page
-     3,SP : destination page
-     4,SP : source offset
-     6,SP : points to length to be copied. This function returns after the size
+  With several page registers, the page register of the source and the one of
+  the destination are looked up once. Both pages are then set once and the
+  area is moved a word at a time with MOVW; a non paged source or destination
+  sets a dummy byte on the stack instead. Only a source and destination in
+  different pages of the same page register need the page switched, once per
+  word. A far object never crosses a page window, so no other page change is
+  needed within a copy. The old behaviour cost two runtime calls per byte.
+
+  stack-structure after the page registers are looked up:
+     0,SP : address of the source page register (or of the dummy at 6,SP)
+     2,SP : address of the destination page register (or of the dummy at 7,SP)
+     4,SP : old value of the source page register
+     5,SP : old value of the destination page register
+     6,SP : dummy page registers, source end address on the slow path
+     8,SP : number of bytes to be copied
+    10,SP : destination offset
+    12,SP : source page
+    13,SP : destination page
+    14,SP : source offset
+    16,SP : return address, past the size. This function returns there
 
   A usual call to this function looks like:
 
@@ -819,28 +833,90 @@ extern "C"
 void NEAR _FAR_COPY_RC(void) {
 #if USE_SEVERAL_PAGES
   asm {
-        DEX                       ;/* source addr-=1, because loop counter ends at 1 */
         PSHX                      ;/* save source offset */
         PSHD                      ;/* save both pages */
-        DEY                       ;/* destination addr-=1, because loop counter ends at 1 */
         PSHY                      ;/* save destination offset */
         LDY     6,SP              ;/* Load Return address */
         LDX     2,Y+              ;/* Load Size to copy */
         STY     6,SP              ;/* Store adjusted return address */
-loop:
-        LDD     4,SP              ;/* load source offset */
-        LEAY    D,X               ;/* calculate actual source address */
-        LDAB    2,SP              ;/* load source page */
-        __PIC_JSR(_LOAD_FAR_8)    ;/* load 1 source byte */
-        PSHB                      ;/* save value */
-        LDD     0+1,SP            ;/* load destination offset */
-        LEAY    D,X               ;/* calculate actual destination address */
-        PULA                      ;/* restore value */
-        LDAB    3,SP              ;/* load destination page */
-        __PIC_JSR(_STORE_FAR_8)   ;/* store one byte */
-        DEX
-        BNE     loop
-        LEAS    6,SP              ;/* release stack */
+        PSHX                      ;/* save size */
+        LEAS    -8,SP             ;/* page register addresses, their old values, dummies */
+
+        LDY     14,SP             ;/* source offset */
+        LEAX    6,SP              ;/* a non paged source "sets" the dummy byte instead */
+        __PIC_JSR(_GET_PAGE_REG)
+        STX     0,SP              ;/* source page register */
+        LDY     10,SP             ;/* destination offset */
+        LEAX    7,SP              ;/* a non paged destination "sets" the dummy byte instead */
+        __PIC_JSR(_GET_PAGE_REG)
+        STX     2,SP              ;/* destination page register */
+        LDX     0,SP
+        LDAA    0,X               ;/* save source page register */
+        STAA    4,SP
+        LDY     2,SP
+        LDAA    0,Y               ;/* save destination page register */
+        STAA    5,SP
+        CPX     2,SP              ;/* both through the same page register? */
+        BNE     fast
+        LDAA    12,SP
+        CMPA    13,SP             ;/* then only the same page can be mapped for both */
+        BNE     slow
+
+fast:                             ;/* set each page once, then move words */
+        LDAA    12,SP
+        STAA    0,X               ;/* set source page register */
+        LDAA    13,SP
+        STAA    0,Y               ;/* set destination page register */
+        LDX     14,SP             ;/* source address */
+        LDY     10,SP             ;/* destination address */
+        LDD     8,SP              ;/* size */
+        LSRD                      ;/* number of words */
+        BEQ     fast_odd
+fast_loop:
+        MOVW    2,X+, 2,Y+        ;/* copy one word */
+        DBNE    D,fast_loop
+fast_odd:
+        BRCLR   9,SP,#1,restore   ;/* even size: done */
+        MOVB    0,X, 0,Y          ;/* copy the last byte */
+        BRA     restore
+
+slow:                             ;/* one page register, two pages: switch it per word */
+        LDD     8,SP
+        ANDB    #0xFE
+        ADDD    14,SP             ;/* source end of the whole words */
+        STD     6,SP              ;/* (the dummies are not used on this path) */
+        LDX     14,SP             ;/* source address */
+        LDY     10,SP             ;/* destination address */
+        CPX     6,SP
+        BEQ     slow_odd
+slow_loop:
+        LDAA    12,SP
+        STAA    [0,SP]            ;/* set source page */
+        LDD     2,X+              ;/* load one word */
+        PSHD
+        LDAA    15,SP
+        STAA    [2,SP]            ;/* set destination page */
+        PULD
+        STD     2,Y+              ;/* store it */
+        CPX     6,SP
+        BNE     slow_loop
+slow_odd:
+        BRCLR   9,SP,#1,restore   ;/* even size: done */
+        LDAA    12,SP
+        STAA    [0,SP]            ;/* set source page */
+        LDAB    0,X               ;/* load the last byte */
+        LDAA    13,SP
+        STAA    [0,SP]            ;/* set destination page */
+        STAB    0,Y               ;/* store it */
+
+restore:
+        LDX     2,SP
+        LDAA    5,SP
+        STAA    0,X               ;/* restore destination page register */
+        LDX     0,SP
+        LDAA    4,SP
+        STAA    0,X               ;/* restore source page register (same value if shared) */
+        LEAS    16,SP             ;/* release stack */
         _SRET                     ;/* debug info only: This is the last instr of a function with a special return */
         RTS                       ;/* return */
   }
@@ -52,9 +52,276 @@
 #include "derivative.h"   /* derivative-specific definitions */
 #include "initLAB1.h"
 
+// Where the ISRs take the next element from
+#define SOURCE_TABLE   0   // struct MorseCode array
+#define SOURCE_STREAM  1   // packed symbol stream
+#define SOURCE_TEXT    2   // text through the ASCII encoder
+#define SOURCE_PAUSE   3   // one silent element
+#define SOURCE_KEYER   4   // paddles, through keyerNext()
+
+// Symbol reader results besides SYM_DOT..SYM_WORD
+#define SYM_END   4        // no more symbols
+#define SYM_WAIT  5        // text encoder has not caught up yet
+
+// Morse code of ASCII 0x20..0x5F: a leading 1 followed by one bit per
+// element, first element first, 1 = dash. 0 = not sendable.
+const unsigned char MORSE_ASCII[64] =
+  {
+    0x00,  /* spc         */
+    0x6B,  /* !  -.-.--   */
+    0x52,  /* "  .-..-.   */
+    0x00,  /* #           */
+    0x89,  /* $  ...-..-  */
+    0x00,  /* %           */
+    0x28,  /* &  .-...    */
+    0x5E,  /* '  .----.   */
+    0x36,  /* (  -.--.    */
+    0x6D,  /* )  -.--.-   */
+    0x00,  /* *           */
+    0x2A,  /* +  .-.-.    */
+    0x73,  /* ,  --..--   */
+    0x61,  /* -  -....-   */
+    0x55,  /* .  .-.-.-   */
+    0x32,  /* /  -..-.    */
+    0x3F,  /* 0  -----    */
+    0x2F,  /* 1  .----    */
+    0x27,  /* 2  ..---    */
+    0x23,  /* 3  ...--    */
+    0x21,  /* 4  ....-    */
+    0x20,  /* 5  .....    */
+    0x30,  /* 6  -....    */
+    0x38,  /* 7  --...    */
+    0x3C,  /* 8  ---..    */
+    0x3E,  /* 9  ----.    */
+    0x78,  /* :  ---...   */
+    0x6A,  /* ;  -.-.-.   */
+    0x00,  /* <           */
+    0x31,  /* =  -...-    */
+    0x00,  /* >           */
+    0x4C,  /* ?  ..--..   */
+    0x5A,  /* @  .--.-.   */
+    0x05,  /* A  .-       */
+    0x18,  /* B  -...     */
+    0x1A,  /* C  -.-.     */
+    0x0C,  /* D  -..      */
+    0x02,  /* E  .        */
+    0x12,  /* F  ..-.     */
+    0x0E,  /* G  --.      */
+    0x10,  /* H  ....     */
+    0x04,  /* I  ..       */
+    0x17,  /* J  .---     */
+    0x0D,  /* K  -.-      */
+    0x14,  /* L  .-..     */
+    0x07,  /* M  --       */
+    0x06,  /* N  -.       */
+    0x0F,  /* O  ---      */
+    0x16,  /* P  .--.     */
+    0x1D,  /* Q  --.-     */
+    0x0A,  /* R  .-.      */
+    0x08,  /* S  ...      */
+    0x03,  /* T  -        */
+    0x09,  /* U  ..-      */
+    0x11,  /* V  ...-     */
+    0x0B,  /* W  .--      */
+    0x19,  /* X  -..-     */
+    0x1B,  /* Y  -.--     */
+    0x1C,  /* Z  --..     */
+    0x00,  /* [           */
+    0x00,  /* \           */
+    0x00,  /* ]           */
+    0x00,  /* ^           */
+    0x4D,  /* _  ..--.-   */
+  };
+
+// Receive side of MORSE_ASCII: its leading-1 code is also the index of the
+// character in a binary tree stored as an array, a dot going from n to 2n
+// and a dash to 2n+1, so decoding a character is one lookup. Characters of
+// up to 6 elements ('$' has 7). 0 = no character.
+const char MORSE_TREE[KEY_TREE_SIZE] =
+  {
+      0,   0, 'E', 'T', 'I', 'A', 'N', 'M',         /* 1, 2 elements */
+    'S', 'U', 'R', 'W', 'D', 'K', 'G', 'O',         /* 3 elements */
+    'H', 'V', 'F',   0, 'L',   0, 'P', 'J',         /* 4 elements */
+    'B', 'X', 'C', 'Y', 'Z', 'Q',   0,   0,
+    '5', '4',   0, '3',   0,   0,   0, '2',         /* 5 elements */
+    '&',   0, '+',   0,   0,   0,   0, '1',
+    '6', '=', '/',   0,   0,   0, '(',   0,
+    '7',   0,   0,   0, '8',   0, '9', '0',
+      0,   0,   0,   0,   0,   0,   0,   0,         /* 6 elements */
+      0,   0,   0,   0, '?', '_',   0,   0,
+      0,   0, '"',   0,   0, '.',   0,   0,
+      0,   0, '@',   0,   0,   0, '\'',   0,
+      0, '-',   0,   0,   0,   0,   0,   0,
+      0,   0, ';', '!',   0, ')',   0,   0,
+      0,   0,   0, ',',   0,   0,   0,   0,
+    ':',   0,   0,   0,   0,   0,   0,   0
+  };
+
 // Global variables
-struct MorseCode *codeStart;    // Pointer to start of code
-struct MorseCode *currentCode;  // Pointer to current code member
+MorseCodePtr codeStart;    // Pointer to start of code (in flash)
+MorseCodePtr currentCode;  // Pointer to current code member
+struct MorseCode currentElement;  // Element being sent, RAM copy read by the ISRs
+unsigned long durationExtra;      // Ticks of the element left after currentElement.duration
+struct MorseCode nextElement;     // Element after it, decoded ahead by toneDurationISR
+unsigned long nextExtra;
+unsigned char nextReady;          // nextElement holds an element, 0 at the end of the code
+unsigned int  tonePhase;          // Fraction of a tick the speaker half-periods are behind
+
+// Whole ticks of the next speaker half-period. With TONE_DITHER the fraction
+// of the tone accumulates in tonePhase and adds one tick whenever it carries,
+// so n and n+1 tick half-periods alternate around the exact pitch.
+#if TONE_DITHER
+#define NEXT_HALF_PERIOD(step) \
+  do { \
+     unsigned int frac_ = TONE_FRAC(currentElement.tone); \
+     (step) = TONE_WHOLE(currentElement.tone); \
+     tonePhase = (tonePhase + frac_) & 0xFFFFU;   /* 16-bit wrap on any int */ \
+     if (tonePhase < frac_) \
+        (step)++; \
+  } while (0)
+#else
+#define NEXT_HALF_PERIOD(step)  ((step) = TONE_ROUND(currentElement.tone))
+#endif
+unsigned char codeSource;         // SOURCE_TABLE .. SOURCE_KEYER
+
+struct MorseFormat msgFormat;     // Tones, LEDs and timing of the stream or text, RAM copy
+unsigned char  gapDue;            // The gap after a dot/dash is due next
+
+const unsigned char *MORSE_FAR streamSymbols; // Symbols of the stream being sent
+unsigned int   streamLength;      // and their number, from its header
+unsigned int   streamPos;         // Index of the next symbol to decode
+
+char (*textSource)(void);         // Next character to encode, 0 at the end
+const char    *textString;        // String walked by nextStringChar()
+unsigned char  textFifo[TEXT_FIFO_SIZE];
+volatile unsigned char textHead;  // Written by pumpText() (main) only
+volatile unsigned char textTail;  // Written by toneDurationISR only
+volatile unsigned char textDone;  // Source exhausted, set after its last symbols
+unsigned char  textGap;           // Gap symbol owed before the next character
+
+unsigned char  eventQueue[EVENT_QUEUE_SIZE]; // EVENT_ numbers for waitEvent()
+volatile unsigned char eventHead; // Written by postEvent() (I bit set) only
+volatile unsigned char eventTail; // Written by waitEvent() (main) only
+volatile unsigned char eventQueued[EVENT_COUNT]; // In the queue, not handed out yet
+
+struct MorseMessage msgQueue[MSG_QUEUE_SIZE];
+volatile unsigned char queueHead; // Written by queueMessage() (masked) only
+volatile unsigned char queueTail; // Written by toneDurationISR only
+volatile unsigned char codeActive; // Tone channels running, from sendCode() to stopCode()
+
+// Timing of stream and text elements, read by nextSymbol() through a near
+// pointer: the message's own timing (msgFormat.timing), or a setTiming() override
+const struct MorseTiming *volatile timingOverride;
+struct MorseTiming wpmTiming[2];  // setWPM() fills the one the ISR isn't using
+unsigned char wpmSel;
+
+const struct MorseTiming MORSE_PRESETS[PRESET_COUNT] =
+  {
+    MORSE_TIMING(10, 10, 30),
+    MORSE_TIMING(13, 13, 30),
+    MORSE_TIMING(15, 15, 30),
+    MORSE_TIMING(20, 20, 30),
+    MORSE_TIMING(25, 25, 30),
+    MORSE_TIMING(18, 13, 30),
+    MORSE_TIMING(20, 13, 30)
+  };
+
+volatile unsigned int timeHigh;   // Upper half of timeNow(), counted by timerOverflowISR
+unsigned char clockFallback;      // 1 if setECLK_MODE() fell back to the crystal
+struct Timer *timerWheel[TIMER_LEVELS * TIMER_SLOTS]; // Slot lists, see initLAB1.h
+unsigned int  timerOccupied[TIMER_LEVELS]; // Bit n: slot n of the level has timers
+unsigned long timerClock;         // Wheel time, slots (timeNow() >> TIMER_SHIFT), never ahead
+unsigned long timerArmed;         // Deadline ALARM_TC is armed for
+unsigned char timerRunning;       // alarmISR is running the timers, it re-arms ALARM_TC
+struct Timer  alarmTimer;         // setAlarm()
+void (*alarmCallback)(void);
+
+// Unlock sequence: SW1, SW2, SW3, SW4, each turning its LED off (see initLAB1.h)
+const struct UnlockStep UNLOCK_SEQUENCE[] =
+  {
+    { BUT_CH4_M, LED234 },
+    { BUT_CH5_M, LED34 },
+    { BUT_CH6_M, LED4 },
+    { BUT_CH7_M, LEDSOFF }
+  };
+const unsigned char UNLOCK_STEPS = sizeof UNLOCK_SEQUENCE / sizeof UNLOCK_SEQUENCE[0];
+
+unsigned char unlockStep;         // Presses of UNLOCK_SEQUENCE matched so far
+struct Timer  unlockTimer;        // Resets an unfinished sequence
+unsigned char buttonsDown;        // Debounced button state, BUT_CHx_M set while pressed
+unsigned long buttonChange[4];    // Edge time of each button's last debounced change
+struct Timer  buttonTimer[4];     // Reads the pin again at the end of the debounce window
+
+unsigned char keyButton;          // BUT_CHx_M of the straight key, 0 if none
+struct KeyEdge keyEdges[KEY_EDGE_SIZE];
+volatile unsigned char keyEdgeHead; // Written by buttonEdge (ISR) only
+volatile unsigned char keyEdgeTail; // Written by pumpKey() (main) only
+unsigned long  keyLastAt;         // Time of the last edge pumpKey() has taken
+unsigned char  keyIsDown;         // and whether it pressed the key
+unsigned long  keyMarks[KEY_MARKS_MAX]; // Mark lengths of the character so far
+unsigned char  keyMarkCount;      // and their number, KEY_MARKS_MAX + 1 once too many
+unsigned char  keyWordDue;        // A character was decoded since the last word gap
+unsigned long  keyUnit;           // Speed estimate, ticks of a unit
+struct Timer   keyTimer;          // at the end of the character, for waitEvent()
+unsigned long  keyWindow[KEY_UNIT_WINDOW]; // Lengths of the last marks and spaces
+unsigned char  keyWindowPos;
+char           keyText[KEY_TEXT_SIZE];
+unsigned char  keyTextHead;       // Written by pumpKey() only
+unsigned char  keyTextTail;       // Written by keyRead() only
+
+struct MorseFormat keyerFormat;   // Sidetone, LEDs and timing of the keyer, RAM copy
+unsigned char  keyerDit;          // BUT_CHx_M of the dit paddle, 0 if no keyer
+unsigned char  keyerDah;          // and of the dah paddle
+unsigned char  keyerPaddles;      // both
+unsigned char  keyerMode;         // KEYER_IAMBIC_A or KEYER_IAMBIC_B
+unsigned char  keyerMemory;       // Paddles pressed since their element was last sent
+unsigned char  keyerSqueeze;      // Both paddles were down during the last element
+unsigned char  keyerLast;         // SYM_DOT or SYM_DASH, the last element sent
+
+struct Lane    lanes[LANE_COUNT];  // LED lanes, see initLAB1.h
+struct Timer   laneTimer;         // at the earliest transition of all lanes
+
+unsigned char  rxActive;          // startReceiver() .. stopReceiver()
+int            rxS1, rxS2;        // Goertzel state of the block being sampled
+unsigned char  rxCount;           // and its samples so far
+unsigned int   rxBlockNumber;     // Blocks completed, low half
+struct RxBlock rxBlocks[RX_BLOCK_FIFO];
+volatile unsigned char rxBlockHead; // Written by rxSampleISR only
+volatile unsigned char rxBlockTail; // Written by pumpReceiver() (main) only
+unsigned long  rxStartAt;         // Time of the first sample
+unsigned int   rxSampleTicks;     // RX_SAMPLE_TICKS in the ticks the TIM counts
+unsigned long  rxBlocksSeen;      // Blocks pumpReceiver() has accounted for
+unsigned int   rxLastNumber;      // and the number of the last one
+unsigned long  rxPeak, rxFloor;   // Tracked tone levels, magnitudes
+unsigned char  rxDown;            // Tone detected, as last queued
+unsigned char  rxHold;            // Blocks in a row that disagree with rxDown
+
+#if ISR_PROFILE
+struct IsrStats isrStats[ISR_ID_COUNT];
+unsigned int isrEntry[ISR_ID_COUNT];
+unsigned int isrLate[ISR_ID_COUNT];
+#endif
+
+static char nextStringChar(void);
+
+// Hot code (see initLAB1.h): element sources, called from toneDurationISR
+#pragma CODE_SEG __NEAR_SEG HOT_ROM
+static void initChannels(void);
+static unsigned char loadCode(void);
+static void loadDuration(unsigned long ticks);
+static unsigned char peekSymbol(void);
+static unsigned char nextSymbol(void);
+static unsigned char nextCode(void);
+static unsigned char beginMessage(const struct MorseMessage *msg);
+static unsigned char nextMessage(void);
+static void armButtons(unsigned char mask);
+static unsigned char keyerNext(void);
+static void keyerStart(void);
+static void keyQueueEdge(unsigned long at, unsigned char down);
+static void buttonCommit(unsigned char ch, unsigned char down, unsigned long edge);
+#pragma CODE_SEG DEFAULT
+static void unlockExpired(struct Timer *timer);
+static void buttonSettled(struct Timer *timer);
 
 /**** FUNCTION DEFINITIONS ******/
 
@@ -73,20 +340,30 @@ struct MorseCode *currentCode;  // Pointer to current code member
 
 void setECLK_MODE(void) 
   {
-  // REQUIREMENTS: Set SYNR and REFDV values to obtain the desired ECLK rate of 4MHz
+  unsigned int polls = PLL_LOCK_POLLS;
+
+  // REQUIREMENTS: Set SYNR and REFDV values to obtain the desired ECLK rate,
+  // ECLK_HZ of the CLOCK_PROFILE (4MHz by default)
 
   // Setting the values of SYNR and REFDV as required
-    SYNR = 0x00;
-   REFDV = 0x00;
+    SYNR = PLL_SYNR;
+   REFDV = PLL_REFDV;
    
   CLKSEL = 0x00; // Ensure the clock is driven from the crystal initially
                  // PLLSEL | PSTP | SYSWAI | ROAWAI | PLLWAI | CWAI | RTIWAI | COPWAI 
   PLLCTL = 0xD1; // Set PLL control
                  // CME | PLLON | AUTO | ACQ | 0 | PRE | PCE | SCME
      
-  // Wait for PLLCLK to stabilize
-  while   ((CRGFLG & CRGFLG_LOCK_MASK)==0);
-  CLKSEL |= CLKSEL_PLLSEL_MASK; // Set the CLKSEL bit to take ECLK = PLLCLK/2
+  // Wait for PLLCLK to stabilize, but not forever: after a brown-out a
+  // beacon on the crystal beats one that never starts
+  while ((CRGFLG & CRGFLG_LOCK_MASK) == 0 && --polls)
+     ;
+  if (polls) {
+     CLKSEL |= CLKSEL_PLLSEL_MASK; // Set the CLKSEL bit to take ECLK = PLLCLK/2
+     clockFallback = 0;
+  } else {
+     clockFallback = 1;            // ECLK = OSCCLK/2 = XTAL_ECLK_HZ
+  }
   
    // Set MODE of operation
   MODE = 0x80;   // Set HCS12 in normal single-chip mode
@@ -105,17 +382,31 @@ void setECLK_MODE(void)
 void initTIM(void)
  {
  
-  // enable TIM
+  // enable TIM; TSWAI clear, it runs on in WAI to wake waitEvent()
   TSCR1 = TSCR1_TEN_MASK;
   
-  // prescale clk to 2^6 = 64
-  TSCR2 = 0x06; //00000110
+  // prescale clk to 2^TIM_PRESCALER (64 at 4 MHz), overflow interrupt extends
+  // TCNT to 32 bits (XTAL_TIM_PRESCALER on the crystal fallback)
+  TSCR2 = TSCR2_TOI_MASK | TIM_PRESCALER_NOW; //10000110
+  timeHigh = 0;
+  timerClock = 0;
+
+  // speaker channel ahead of the other interrupts (I bit is still set here)
+  HPRIO = ISR_HPRIO;
   
   // disable all TIM interrupts
   TIE = 0x00;
   
   // clear all TIM interrupt flags    
   TFLG1 = 0xFF;
+  TFLG2 = TFLG2_TOF_MASK;
+
+#if ISR_PROFILE
+  // modulus counter free running at ECLK: prescaler 1, reloaded with 0xFFFF
+  MCCTL = MCCTL_MODMC_MASK | MCCTL_MCEN_MASK;
+  MCCNT = 0xFFFF;
+  resetIsrStats();
+#endif
  }
  
 /********************************************************************************
@@ -168,27 +459,62 @@ void setLEDs(unsigned char leds)
  }
 
 /*********************************************************************************
-* Function   void initCODE(struct MorseCode *code) 
+* Function: void initATD(void)
+* REQUIREMENTS:
+*  - Power ATD0 up: 8-bit results, left justified (ATD0DR0H), one conversion
+*    per write to ATD0CTL5, flag cleared by reading the result
+*  - ATD clock at most 2 MHz on whichever bus runs, sampling 2 ATD clocks:
+*    a conversion takes 7 us at 2 MHz
+*********************************************************************************/
+void initATD(void)
+  {
+  ATD0CTL2 = ATD0CTL2_ADPU_MASK | ATD0CTL2_AFFC_MASK;
+  ATD0CTL3 = ATD0CTL3_S1C_MASK;
+  ATD0CTL4 = ATD0CTL4_SRES8_MASK | RX_ATD_PRS;
+  }
+
+/*********************************************************************************
+* Function: void initSCI(void)
+* REQUIREMENTS:
+*  - SCI0 (the board's serial port) at 9600 baud, 8N1, transmitter only
+*********************************************************************************/
+void initSCI(void)
+  {
+  if (clockFallback)
+     SCI0BD = (unsigned int)((XTAL_ECLK_HZ + 8UL * 9600UL) / (16UL * 9600UL));
+  else
+     SCI0BD = (unsigned int)((ECLK_HZ + 8UL * 9600UL) / (16UL * 9600UL));  // 26 at 4 MHz
+  SCI0CR1 = 0x00;
+  SCI0CR2 = SCI0CR2_TE_MASK;
+  }
+
+/*********************************************************************************
+* Function: void sciPutChar(char c)
+* REQUIREMENTS:
+*  - Wait for the transmit data register to empty, then send c
+*********************************************************************************/
+void sciPutChar(char c)
+  {
+  while ((SCI0SR1 & SCI0SR1_TDRE_MASK) == 0)
+     ;
+  SCI0DRL = c;
+  }
+
+#pragma CODE_SEG __NEAR_SEG HOT_ROM
+/*********************************************************************************
+* Function   void initChannels(void) 
 * REQUIREMENTS:
-*    - Initialize pointer to start of code
-*    - Initialize pointer to current code member,
 *    - Enable Output Compare channels, disconnect speaker,
 *    - Disable Speaker and Duration channel interrupts,
 *    - Clear Speaker and Duration channel interrupt flags,
 *    - Set LED pattern to 1111. 
-*  Inputs:  Pointer to beginning of Morse Code
+*  Inputs:  none
 *  Outputs: LED pattern 
 *********************************************************************************/                   
-void initCode(struct MorseCode *code)
+static void initChannels(void)
   {   
-  //Initialize pointer to start of code
-  codeStart = code;
-    
-  //Initialize pointer to current code member,
-  currentCode = code;   
-  
   //Enable Output Compare channels, disconnect speaker. Ch(7:4) (for buttons) default to input 
-  TIOS |= SPEAKER | TONEDURATION;
+  TIOS |= TONE_CHANNELS;
 
 
   // Setting all the values in TCTL2 to be 0 upon initialization --> port T channels 3:0 are disconnected.
@@ -196,13 +522,23 @@ void initCode(struct MorseCode *code)
   TCTL2 = 0x00;
   
   //Disable Speaker and Duration channel interrupts,
-  TIE &= ~(SPEAKER | TONEDURATION);  
+  TIE &= ~(TONE_CHANNELS);  
   
   //Clear Speaker and Duration channel interrupt flags,
-  TFLG1 |= SPEAKER | TONEDURATION;
+  TIM_ACK(TONE_CHANNELS);
+
+#if TONE_BACKEND == TONE_BACKEND_PWM
+  // PWM 6/7 as one 16-bit channel, left aligned, high first, clocked from clock B
+  PWME &= ~PWME_PWME7_MASK;
+  PWMCTL |= PWMCTL_CON67_MASK;
+  PWMCLK &= ~PWMCLK_PCLK7_MASK;
+  PWMPRCLK = (PWMPRCLK & 0x0F) | PWM_TONE_PCKB;
+  PWMPOL |= PWMPOL_PPOL7_MASK;
+  PWMCAE &= ~PWMCAE_CAE7_MASK;
+#endif
   
   //Set LED pattern to 1111 .
-  setLEDs(0xF0);
+  SET_LEDS(0xF0);
 
   
   // Ch(7:4) in TIOS automatically set to 0 (input)!
@@ -211,249 +547,2120 @@ void initCode(struct MorseCode *code)
   // Refer to Notes - 2 for a quick note on this.
   // TCTL3 = 0x00;
   
-  // Disarm interrupts of buttons
-  TIE &= 0x0F;
+  // Disarm interrupts of buttons, a message cancels the unlock sequence
+  // (a straight key goes on being decoded, paddles go on keying)
+  TIE &= 0x0F | keyButton | keyerPaddles;
+  unlockStep = 0;
   
   // Clear button channel flags
-  TFLG1 |= 0xF0;
+  TIM_ACK(BUTTONS_M & ~(keyButton | keyerPaddles));
 
   }
-  
+#pragma CODE_SEG DEFAULT
+
 /*********************************************************************************
-* Function   void sendCode(void)
-* REQUIREMENTS: 
-* Uses current code pointer to
-*    - Set tone value in SPEAKER_TC
-*    - Set duration value in DURATION_TC
-*    - Set LED pattern for current tone
-*    and
-*    - Enable interrupts for Speaker and Duration channels 
-*    - Clear interrupt flags for Speaker and Duration channels
-*    - Enable Speaker toggle without affecting other channels    
-*  Inputs: none      
-*  Outputs: LED pattern for note and tone heard on speaker.   
-*********************************************************************************/                    
-void sendCode(void)
-  {             
-  //Set tone value in SPEAKER_TC
-  SPEAKER_TC = (currentCode -> tone) + TCNT;      //TCNT
-  
-  //Set duration value in DURATION_TC
-  DURATION_TC = (currentCode -> duration) + TCNT;	
-  
-  //Set LED pattern for current tone
-  setLEDs(currentCode -> leds);  
+* Function   void initMessage(const struct MorseMessage *msg) 
+* REQUIREMENTS:
+*    - Point the element source at the message (see beginMessage)
+*    - Prepare the TIM channels (see initChannels)
+*  Inputs:  Message descriptor, only read here
+*  Outputs: LED pattern 
+*********************************************************************************/                   
+static void initMessage(const struct MorseMessage *msg)
+  {
+  nextReady = beginMessage(msg);
 
-  //Enable interrupts for Speaker and Duration channels 
-  TIE |= SPEAKER | TONEDURATION;
+  initChannels();
+  }
 
-  //Clear interrupt flags for Speaker and Duration channels
-  TFLG1 |= SPEAKER | TONEDURATION;  
-  
-  //Enable Speaker toggle without affecting other channels
-  TCTL2 |= SPKR_ON;
+/*********************************************************************************
+* Function   void initCODE(MorseCodePtr code) 
+* REQUIREMENTS:
+*    - Initialize pointer to start of code
+*    - Initialize pointer to current code member,
+*    - Load the first element
+*    - Prepare the TIM channels (see initChannels)
+*  Inputs:  Pointer to beginning of Morse Code
+*  Outputs: LED pattern 
+*********************************************************************************/                   
+void initCode(MorseCodePtr code)
+  {   
+  struct MorseMessage msg;
 
+  msg.kind = MSG_TABLE;
+  msg.code = code;
+  initMessage(&msg);
   }
-  
- 
-  
-/********************************************************************************* 
-* Function   void stopCode(void) 
-* REQUIREMENTS: 
-*    - Disable speaker and duration interrupts,
-*    - Clear speaker and duration interrupt flags,
-*    - Disable speaker toggling (turns off speaker),
-*    - Turn ON all LEDs to indicate end of code,
-*  Inputs:  none
-*  Outputs: All LEDs are turned ON.  
-*********************************************************************************/                
-void stopCode(void)
-  {
 
-  //Disable speaker and duration interrupts,
-  TIE &= ~(SPEAKER | TONEDURATION);
-  
-  //Clear speaker and duration interrupt flags,
-  TFLG1 |= SPEAKER | TONEDURATION;
-  
-  //Disable speaker toggling (turns off speaker),
-  TCTL2 &= SPKR_OFF;
-  
-  //Turn ON all LEDs to indicate end of code,
-  setLEDs(~LEDSOFF);
-  
-  // Arming SW1 interrupt on ch4 - only this interrupt can be "invoked" now.
-  TIE = BUT_CH4_M;
-  
-  // Clear button channel interrupt flags
-  TFLG1 |= 0xF0;
-  
-  // Here, set button ISRs to only detect and run on falling edge
-  TCTL3 = 0xAA;
+/*********************************************************************************
+* Function   void initStream(MorseStreamPtr stream) 
+* REQUIREMENTS:
+*    - Point the decoder at the first symbol of a packed stream
+*    - Decode the first element
+*    - Prepare the TIM channels (see initChannels)
+*  Inputs:  Pointer to the stream header
+*  Outputs: LED pattern 
+*********************************************************************************/                   
+void initStream(MorseStreamPtr stream)
+  {   
+  struct MorseMessage msg;
 
-  } 
- 
-/****** Start of PRAGMA and ISRs ******/
-/********************************************************************************
-*  ISR:  toneDurationISR - is called whenever TCNT hits DURATION_TC.      
-*
-*       
-*  REQUIREMENTS:
-*    - If end of code (brk) reached, stop sending code
-*      else 
-*    - Update tone, duration and LED pattern for current code
-*    - Clear duration interrupt flag,
-*    - Advance pointer to next code
-*  Inputs: None       
-*  Outputs:LED pattern for current code
-********************************************************************************  */          
+  msg.kind = MSG_STREAM;
+  msg.stream = stream;
+  initMessage(&msg);
+  }
 
-#pragma CODE_SEG NON_BANKED
-void interrupt VectorNumber_Vtimch0 toneDurationISR(void)
+/*********************************************************************************
+* Function   void initTextSource(MorseFormatPtr format, char (*next)(void))
+* REQUIREMENTS:
+*    - Start the ASCII encoder on a character generator
+*    - Fill the symbol FIFO and decode the first element
+*    - Prepare the TIM channels (see initChannels)
+*  Inputs:  Tones/LEDs/timing to send with, generator returning the next
+*           character or 0 at the end of the text
+*  Outputs: LED pattern 
+*********************************************************************************/                   
+void initTextSource(MorseFormatPtr format, char (*next)(void))
   {
-     
-     // If currentCode reached end of struct array, stop sending the code
-     if (currentCode -> tone == brk) {
-     
-        stopCode();
-        
-     } else {  // Otherwise, prep for next duration interrupt...
-     
-        // update the tone, duration, and LED pattern to that of current code
-        SPEAKER_TC = (currentCode -> tone) + TCNT;
-        DURATION_TC = (currentCode -> duration) + TCNT;
-        setLEDs(currentCode -> leds);  
-      
-        // Next, clear duration's interrupt flag
-        TFLG1 |= TONEDURATION;
-        
-        // Finally, advance pointer to next morse code through incrementation
-        currentCode++;
+  struct MorseMessage msg;
 
-     }
+  msg.kind = MSG_SOURCE;
+  msg.format = format;
+  msg.source = next;
+  initMessage(&msg);
+  }
 
-  }                                 
+/*********************************************************************************
+* Function   void initText(MorseFormatPtr format, const char *text)
+* REQUIREMENTS:
+*    - Start the ASCII encoder on a C string (see initTextSource). The string
+*      is read as it is sent and must stay valid until then.
+*********************************************************************************/                   
+static char nextStringChar(void)
+  {
+  return *textString ? *textString++ : 0;
+  }
 
-/********************************************************************************
-*  ISR: SpeakerISR
-*  REQUIREMENTS:
-*     - If tone is blank, turn off speaker toggle  
-*        else
-*     - Turn on speaker toggle
-*     - Clear speaker interrupt flag,
-*     - Update speaker half-period to continue with current tone
-*  Outputs: Current cone continues to be sent 
-*********************************************************************************/           
+void initText(MorseFormatPtr format, const char *text)
+  {
+  struct MorseMessage msg;
 
-void interrupt VectorNumber_Vtimch3 SpeakerISR(void)
+  msg.kind = MSG_TEXT;
+  msg.format = format;
+  msg.text = text;
+  initMessage(&msg);
+  }
+
+#pragma CODE_SEG __NEAR_SEG HOT_ROM
+/*********************************************************************************
+* Function   void pumpText(void)
+* REQUIREMENTS:
+*    - Encode characters into the symbol FIFO while a whole character fits
+*    - Letter gaps are pushed with the character that follows them, so a
+*      space can still turn them into a word gap
+*    - Set textDone once the source returns 0
+*  Call from the main loop while text is being sent; returns at once otherwise.
+*********************************************************************************/                   
+void pumpText(void)
   {
+  unsigned char code, n, sym;
+  char c;
 
-     // Ack speakerISR's interrupt flag
-     TFLG1 |= SPEAKER;
-     
-     // If current tone is blank, turn off speaker toggle (so we don't hear anything)
-     if (currentCode -> tone == blank) {
-     
-        TCTL2 &= SPKR_OFF;
-      
+  if (codeSource != SOURCE_TEXT)
+    return;
+
+  while (!textDone &&
+         (unsigned char)(TEXT_FIFO_SIZE - (unsigned char)(textHead - textTail)) >= TEXT_CHAR_MAX) {
+
+     c = textSource();
+     if (c == 0) {
+        textDone = 1;
+        break;
+     }
+     if (c == ' ') {
+        textGap = SYM_WORD;
+        continue;
      }
-     
-     else {   // Otherwise, turn on/keep playing speaker, and set the tone duration
-     
-        // Turn on speaker toggle
-        TCTL2 = (TCTL2 & 0x3F) | SPKR_ON;     
-        
-        // Update speaker with the half period of the current tone to continue making the noise
-        SPEAKER_TC = (currentCode -> tone) + TCNT;
-              
-     }      
-  }   
 
-  
+     // constant time lookup; lower case maps onto upper case
+     if (c >= 'a' && c <= 'z')
+        c -= 'a' - 'A';
+     code = (c >= 0x20 && c < 0x60) ? MORSE_ASCII[c - 0x20] : 0;
+     if (code == 0)
+        continue;
 
-// ----------- Button switches ISRs -------------
+     if (textGap) {
+        textFifo[textHead & TEXT_FIFO_MASK] = textGap;
+        textHead++;
+     }
+     textGap = SYM_LETTER;
 
+     // find the leading 1, then one symbol per element below it
+     for (n = 7; !(code & (1 << n)); n--)
+        ;
+     while (n--) {
+        sym = (code & (1 << n)) ? SYM_DASH : SYM_DOT;
+        textFifo[textHead & TEXT_FIFO_MASK] = sym;
+        textHead++;
+     }
+  }
+  }
+#pragma CODE_SEG DEFAULT
 
 /*********************************************************************************
-*  ISR:  SW1_ISR
-*  REQUIREMENTS: - Arm/Disarm switches of interest
-*                - Set LEDs to required pattern
-*                - Clear relevant interrupt flags
-*  Outputs: LED pattern of (X I I I)
-* ********************************************************************************/           
-void interrupt VectorNumber_Vtimch4 SW1_ISR(void)
+* Function   unsigned char queueMessage(const struct MorseMessage *msg)
+* REQUIREMENTS:
+*    - Copy the descriptor into the next free slot of the transmit queue,
+*      then publish it by advancing queueHead
+*    - The message is sent once everything before it is: toneDurationISR
+*      picks it up at the end of the current message, sendQueued() when
+*      nothing is being sent. Tables, streams and strings are read as they
+*      are sent and must stay valid until then.
+*    - From main and from the alarm callbacks: interrupts are masked for
+*      the copy, then the caller's I bit is restored
+*  Inputs:  Message descriptor
+*  Outputs: 1 if queued, 0 if the queue is full
+*********************************************************************************/                   
+unsigned char queueMessage(const struct MorseMessage *msg)
   {
+  unsigned char queued = 0;
+  unsigned char ccr;
 
-    // When this runs, only allow SW2's ISR on ch5 to be invoked next.
-    // Also, turn off LEDs so SW1's light is off.
-    // Finally, acknowledge the just called interrupt.
+  MASK_INTERRUPTS(ccr);
+  if ((unsigned char)(queueHead - queueTail) < MSG_QUEUE_SIZE) {
+    msgQueue[queueHead & MSG_QUEUE_MASK] = *msg;
+    queueHead++;
+    queued = 1;
+  }
+  RESTORE_INTERRUPTS(ccr);
+  return queued;
+  }
 
-     TIE = BUT_CH5_M;
-     setLEDs(LED234);
-     TFLG1 |= BUT_CH4_M;
-     
-  } 
+unsigned char queueCode(MorseCodePtr code)
+  {
+  struct MorseMessage msg;
 
+  msg.kind = MSG_TABLE;
+  msg.code = code;
+  return queueMessage(&msg);
+  }
+
+unsigned char queueStream(MorseStreamPtr stream)
+  {
+  struct MorseMessage msg;
+
+  msg.kind = MSG_STREAM;
+  msg.stream = stream;
+  return queueMessage(&msg);
+  }
+
+unsigned char queueText(MorseFormatPtr format, const char *text)
+  {
+  struct MorseMessage msg;
+
+  msg.kind = MSG_TEXT;
+  msg.format = format;
+  msg.text = text;
+  return queueMessage(&msg);
+  }
+
+unsigned char queuePause(unsigned long ticks)
+  {
+  struct MorseMessage msg;
+
+  msg.kind = MSG_PAUSE;
+  msg.ticks = ticks;
+  return queueMessage(&msg);
+  }
 
+#pragma CODE_SEG __NEAR_SEG HOT_ROM
 /*********************************************************************************
-*  ISR:  SW2_ISR
-*  REQUIREMENTS: - Arm/Disarm switches of interest
-*                - Set LEDs to required pattern
-*                - Clear relevant interrupt flags
-*  Outputs: LED pattern of (X X I I)
-* ********************************************************************************/   
-void interrupt VectorNumber_Vtimch5 SW2_ISR(void)
+* Function   void sendQueued(void)
+* REQUIREMENTS:
+*    - If no code is being sent, start the first queued message
+*      (see initCode and sendCode). The tone interrupts are off while
+*      idle; interrupts are masked so that main and an alarm callback
+*      can't both take the tail, then the caller's I bit is restored.
+*********************************************************************************/                   
+void sendQueued(void)
   {
+  unsigned char ccr;
 
-    // When this runs, only allow SW3's ISR on ch6 to be invoked next.
-    // Also, turn off LEDs so SW2's light is also off.
-    // Finally, acknowledge the just called interrupt.
+  MASK_INTERRUPTS(ccr);
+  if (!codeActive) {
+    nextReady = nextMessage();
+    if (nextReady) {
+      initChannels();
+      sendCode();
+    }
+  }
+  RESTORE_INTERRUPTS(ccr);
+  }
+#pragma CODE_SEG DEFAULT
 
-     TIE = BUT_CH6_M;
-     setLEDs(LED34);
-     TFLG1 |= BUT_CH5_M;
-  } 
+unsigned char codeBusy(void)
+  {
+  return codeActive;
+  }
+
+/*********************************************************************************
+* Function   void setTiming(const struct MorseTiming *timing)
+* REQUIREMENTS:
+*    - Send streams and text with the given timing instead of the one in
+*      their MorseFormat, from the next element on; 0 goes back to the
+*      per-message timing. Tables carry their own durations and are not
+*      affected. The timing is read by the ISR and must stay valid.
+*    - setTimingPreset() selects one of the compile-time MORSE_PRESETS
+*********************************************************************************/                   
+void setTiming(const struct MorseTiming *timing)
+  {
+  timingOverride = timing;   // one 16-bit store, the ISR sees old or new
+  }
 
+void setTimingPreset(unsigned char preset)
+  {
+  if (preset < PRESET_COUNT)
+    setTiming(&MORSE_PRESETS[preset]);
+  }
+
+// A timing for any speed, with the same integer formulas as the presets
+static void fillTiming(struct MorseTiming *t, unsigned char wpm, unsigned char fwpm,
+                       unsigned char dashWeight)
+  {
+  t -> dotTicks    = MORSE_UNIT(wpm);
+  t -> dashTicks   = MORSE_DASH(wpm, dashWeight);
+  t -> gapTicks    = MORSE_UNIT(wpm);
+  t -> letterTicks = MORSE_LETTER(wpm, fwpm);
+  t -> wordTicks   = MORSE_WORD(wpm, fwpm);
+  }
 
 /*********************************************************************************
-*  ISR:  SW3_ISR
-*  REQUIREMENTS: - Arm/Disarm switches of interest
-*                - Set LEDs to required pattern
-*                - Clear relevant interrupt flags
-*  Outputs: LED pattern of (X X X I)
-* ********************************************************************************/   
-void interrupt VectorNumber_Vtimch6 SW3_ISR(void)
+* Function   unsigned char setWPM(unsigned char wpm, unsigned char fwpm,
+*                                 unsigned char dashWeight)
+* REQUIREMENTS:
+*    - Compute a timing for any speed with the same integer formulas as the
+*      presets (long division, main only), then switch to it with setTiming()
+*    - The timing is built in the buffer the ISR is not reading
+*  Inputs:  character speed, Farnsworth overall speed (<= wpm), dash length in
+*           tenths of a unit
+*  Outputs: 1 if switched, 0 if out of range
+*********************************************************************************/                   
+unsigned char setWPM(unsigned char wpm, unsigned char fwpm, unsigned char dashWeight)
   {
+  struct MorseTiming *t;
 
-      // When this runs, only allow SW4's ISR on ch7 to be invoked next.
-      // Also, turn off LEDs so SW3's light is also off.
-      // Finally, acknowledge the just called interrupt.
+  if (wpm == 0 || fwpm == 0 || fwpm > wpm || dashWeight < 10)
+    return 0;
 
-     TIE = BUT_CH7_M;
-     setLEDs(LED4);
-     TFLG1 |= BUT_CH6_M;
-  } 
+  wpmSel ^= 1;
+  t = &wpmTiming[wpmSel];
+  fillTiming(t, wpm, fwpm, dashWeight);
+  setTiming(t);
+  return 1;
+  }
+
+#pragma CODE_SEG __NEAR_SEG HOT_ROM
+/*********************************************************************************
+* Function   unsigned long timeNow(void)
+* REQUIREMENTS:
+*    - Return timeHigh:TCNT as one monotonic 32-bit tick count
+*    - From main: re-read if timerOverflowISR ran between the two halves
+*    - From an ISR (I bit set): a pending TOF with a small TCNT means the
+*      counter wrapped after timeHigh was last counted
+*  Outputs: TIM ticks since initTIM()
+*********************************************************************************/                   
+unsigned long timeNow(void)
+  {
+  unsigned int high, low;
+
+  do {
+     high = timeHigh;
+     low = TCNT;
+  } while (high != timeHigh);
 
+  if ((TFLG2 & TFLG2_TOF_MASK) && low < 0x8000U)
+     high++;
+  return ((unsigned long)high << 16) | low;
+  }
 
 /*********************************************************************************
-*  ISR:  SW4_ISR
-*  REQUIREMENTS: - Arm/Disarm switches of interest
-*                - Set LEDs to required pattern
-*                - Clear relevant interrupt flags
-*  Outputs: LED pattern of (X X X X)
-* ********************************************************************************/   
-void interrupt VectorNumber_Vtimch7 SW4_ISR(void)
+* Function   static void timerLink(struct Timer *timer)
+* REQUIREMENTS:
+*    - Put the timer in the wheel (see initLAB1.h): the level of the highest
+*      digit its deadline, in slots, doesn't share with timerClock
+*    - A deadline before the clock goes in the clock's own slot of level 0
+*********************************************************************************/                   
+static void timerLink(struct Timer *timer)
   {
+  unsigned long at = (timer->deadline >> TIMER_SHIFT) & TIMER_CLOCK_MASK;
+  unsigned long diff;
+  unsigned char level = 0, slot;
 
-      // When this runs, disable all ISRs on all channels.
-      // Also, turn off LEDs so SW4's light is also off. At this point, should be all off.
-      // Finally, acknowledge the just called interrupt.
+  if (TIME_DUE(timer->deadline, timerClock << TIMER_SHIFT))
+     at = timerClock;
+  for (diff = (at ^ timerClock) >> TIMER_BITS; diff; diff >>= TIMER_BITS)
+     level++;
+  slot = (unsigned char)((at >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1));
 
-     TIE = 0x00;
-     setLEDs(LEDSOFF);
-     TFLG1 |= BUT_CH7_M;
+  timer->slot = (unsigned char)(level * TIMER_SLOTS + slot);
+  timer->next = timerWheel[timer->slot];
+  if (timer->next)
+     timer->next->prev = &timer->next;
+  timerWheel[timer->slot] = timer;
+  timer->prev = &timerWheel[timer->slot];
+  timerOccupied[level] |= 1U << slot;
+  }
+
+/*********************************************************************************
+* Function   static struct Timer *timerEarliest(void)
+* REQUIREMENTS:
+*    - Find the first occupied slot of the lowest occupied level: every
+*      timer in it is due before those in any other slot
+*    - Level 0 has the clock's slot and those after it; the slots of a level
+*      above come after the clock's digit, and wrap with the 32-bit time
+*  Outputs: the timer of that slot with the earliest deadline, 0 if none
+*********************************************************************************/                   
+static struct Timer *timerEarliest(void)
+  {
+  struct Timer *first, *timer;
+  unsigned int occupied;
+  unsigned char level, slot = 0;
+
+  for (level = 0; level < TIMER_LEVELS; level++) {
+     occupied = timerOccupied[level];
+     if (!occupied)
+        continue;
+     if (level)
+        slot = (unsigned char)((timerClock >> (TIMER_BITS * level)) + 1) & (TIMER_SLOTS - 1);
+     while (!(occupied & (1U << slot)))
+        slot = (slot + 1) & (TIMER_SLOTS - 1);
+
+     first = timerWheel[level * TIMER_SLOTS + slot];
+     for (timer = first->next; timer; timer = timer->next)
+        if ((long)(timer->deadline - first->deadline) < 0)
+           first = timer;
+     return first;
+  }
+  return 0;
+  }
+
+/*********************************************************************************
+* Function   static void timerArm(struct Timer *timer)
+* REQUIREMENTS:
+*    - Arm ALARM_TC for the timer's deadline, disarm it if there is none
+*    - ALARM_TC compares against the low half of the deadline; alarmISR
+*      lets every match but the last one pass (one per 65536 ticks)
+*    - A deadline already due, or due within TIMER_LEAD, fires TIMER_LEAD
+*      ticks from now
+*********************************************************************************/                   
+static void timerArm(struct Timer *timer)
+  {
+  if (!timer) {
+     TIE &= ~ALARM;
+     return;
+  }
+  timerArmed = timer->deadline;
+
+  TIOS |= ALARM;
+  if ((long)(timerArmed - timeNow()) < TIMER_LEAD)
+     ALARM_TC = TCNT + TIMER_LEAD;
+  else
+     ALARM_TC = (unsigned int)timerArmed;
+  TIM_ACK(ALARM);
+  TIE |= ALARM;
+  }
+
+/*********************************************************************************
+* Function   void timerInsert(struct Timer *timer, unsigned long deadline,
+*                             void (*callback)(struct Timer *timer))
+* REQUIREMENTS:
+*    - (Re)start the timer: call back once timeNow() reaches the deadline,
+*      up to 2^31 ticks ahead (9.5 hours at 62.5 kHz)
+*    - Move ALARM_TC earlier if the deadline is the first one, never later:
+*      a compare left for a timer that has gone finds nothing due and
+*      re-arms for the next one
+*    - Into an empty wheel, bring timerClock up to timeNow() first: it only
+*      moves as timers fire, and 2^31 ticks behind every deadline would
+*      look due and pile up in the clock's slot
+*    - With the I bit set (an ISR); from main, startTimer()
+*  Inputs:  timer, timeNow() value to fire at, callback
+*********************************************************************************/                   
+void timerInsert(struct Timer *timer, unsigned long deadline, void (*callback)(struct Timer *timer))
+  {
+  unsigned char level;
+
+  timerRemove(timer);
+  for (level = 0; level < TIMER_LEVELS && !timerOccupied[level]; level++)
+     ;
+  if (level == TIMER_LEVELS)
+     timerClock = (timeNow() >> TIMER_SHIFT) & TIMER_CLOCK_MASK;
+  timer->deadline = deadline;
+  timer->callback = callback;
+  timerLink(timer);
+
+  if (!timerRunning && (!(TIE & ALARM) || (long)(deadline - timerArmed) < 0))
+     timerArm(timer);
+  }
+
+/*********************************************************************************
+* Function   void timerRemove(struct Timer *timer)
+* REQUIREMENTS:
+*    - Take the timer out of the wheel, if it is started
+*    - With the I bit set (an ISR); from main, cancelTimer()
+*********************************************************************************/                   
+void timerRemove(struct Timer *timer)
+  {
+  if (!timer->prev)
+     return;
+  *timer->prev = timer->next;
+  if (timer->next)
+     timer->next->prev = timer->prev;
+  if (!timerWheel[timer->slot])
+     timerOccupied[timer->slot >> TIMER_BITS] &= ~(1U << (timer->slot & (TIMER_SLOTS - 1)));
+  timer->prev = 0;
+  }
+#pragma CODE_SEG DEFAULT
+
+/*********************************************************************************
+* Function   void startTimer(struct Timer *timer, unsigned long deadline,
+*                            void (*callback)(struct Timer *timer))
+*            void cancelTimer(struct Timer *timer)
+* REQUIREMENTS:
+*    - timerInsert()/timerRemove() from main and from the timer callbacks,
+*      with interrupts masked for the wheel
+*    - Give the caller back its own I bit, clear or set
+*    - The callback runs in alarmISR, with the I bit clear under
+*      NEST_ALARM. It may start and cancel timers, itself included, post
+*      events with queueEvent(), and queue and start messages: those calls
+*      mask interrupts for themselves. Other state shared with main needs
+*      the same masking, or an event for main to act on.
+*********************************************************************************/                   
+void startTimer(struct Timer *timer, unsigned long deadline, void (*callback)(struct Timer *timer))
+  {
+  unsigned char ccr;
+
+  MASK_INTERRUPTS(ccr);
+  timerInsert(timer, deadline, callback);
+  RESTORE_INTERRUPTS(ccr);
+  }
+
+void cancelTimer(struct Timer *timer)
+  {
+  unsigned char ccr;
+
+  MASK_INTERRUPTS(ccr);
+  timerRemove(timer);
+  RESTORE_INTERRUPTS(ccr);
+  }
+
+// setAlarm()'s timer calls the alarm's own callback
+static void alarmExpired(struct Timer *timer)
+  {
+  (void)timer;
+  alarmCallback();
+  }
+
+/*********************************************************************************
+* Function   void setAlarm(unsigned long deadline, void (*callback)(void))
+* REQUIREMENTS:
+*    - Call back once timeNow() reaches the deadline, any distance ahead,
+*      as one of the software timers
+*    - A deadline already due fires a few ticks from now
+*    - The callback runs in alarmISR and may call setAlarm() again, and
+*      queueMessage() and sendQueued(), which mask interrupts against main
+*  Inputs:  timeNow() value to fire at, callback
+*********************************************************************************/                   
+void setAlarm(unsigned long deadline, void (*callback)(void))
+  {
+  cancelTimer(&alarmTimer);
+  alarmCallback = callback;
+  startTimer(&alarmTimer, deadline, alarmExpired);
+  }
+
+void cancelAlarm(void)
+  {
+  cancelTimer(&alarmTimer);
+  }
+
+// Empty the edge queue and the decoded text, speed back to MORSE_WPM
+static void keyReset(void)
+  {
+  unsigned char i;
+
+  keyEdgeHead = keyEdgeTail = 0;
+  keyTextHead = keyTextTail = 0;
+  keyMarkCount = 0;
+  keyWordDue = 0;
+  keyIsDown = 0;
+  keyUnit = MORSE_UNIT(MORSE_WPM);
+  for (i = 0; i < KEY_UNIT_WINDOW; i++)
+     keyWindow[i] = keyUnit;
+  keyWindowPos = 0;
+  keyLastAt = timeNow();
+  }
+
+/*********************************************************************************
+* Function   void startKey(unsigned char button)
+* REQUIREMENTS:
+*    - Decode the button as a straight key from now on (see initLAB1.h),
+*      starting at the MORSE_WPM speed; it no longer counts for the unlock
+*    - Empty the edge queue and the decoded text
+*  Inputs:  BUT_CHx_M of the key
+*********************************************************************************/
+void startKey(unsigned char button)
+  {
+  stopReceiver();
+  TIE &= ~button;
+  keyReset();
+  keyButton = button;
+  armButtons(button);
+  }
+
+void stopKey(void)
+  {
+  TIE &= ~keyButton;
+  keyButton = 0;
+  cancelTimer(&keyTimer);
+  }
+
+// keyTimer's callback: the character's end is due, pumpKey() from main
+static void keyDue(struct Timer *timer)
+  {
+  (void)timer;
+  queueEvent(EVENT_KEY);
+  }
+
+// Decoded character into keyText[], dropped if it is full
+static void keyPut(char c)
+  {
+  if ((unsigned char)(keyTextHead - keyTextTail) < KEY_TEXT_SIZE) {
+     keyText[keyTextHead & KEY_TEXT_MASK] = c;
+     keyTextHead++;
+  }
+  }
+
+// End of a character: classify its marks by the unit as it is now, walking
+// the tree from the root, a dash to 2n+1 and a dot to 2n
+static void keyFlush(void)
+  {
+  unsigned char code = 1, i;
+  char c = 0;
+
+  if (keyMarkCount == 0)
+     return;
+  if (keyMarkCount <= KEY_MARKS_MAX) {
+     for (i = 0; i < keyMarkCount; i++)
+        code = (unsigned char)(2 * code + (keyMarks[i] >= 2 * keyUnit));
+     c = MORSE_TREE[code];
+  }
+  keyPut(c ? c : KEY_UNKNOWN);
+  keyMarkCount = 0;
+  keyWordDue = 1;
+  }
+
+/*********************************************************************************
+* Function   void pumpKey(void)
+* REQUIREMENTS:
+*    - Take the key's edges from keyEdges[]: each one ends a mark or a space
+*    - Update the unit from the last KEY_UNIT_WINDOW lengths (the mean of
+*      the one-unit ones, within 1.5 times the shortest), then classify
+*      the space: between elements, end of the character from 2 units, end
+*      of the word from 5
+*    - Keep the marks of the character; at its end they are dots, or dashes
+*      from 2 units, by the unit then (keyFlush), and MORSE_TREE[] gives it
+*    - End the character once the space running now reaches 2 units, so the
+*      last one of a message doesn't wait for the next press; until then
+*      keyTimer posts EVENT_KEY for that time
+*  Call from the main loop; returns at once without a key or receiver.
+*********************************************************************************/
+void pumpKey(void)
+  {
+  unsigned long now, len, shortest, sum;
+  unsigned char i, n, down;
+
+  if (!keyButton && !rxActive)
+     return;
+
+  now = timeNow();
+  while (keyEdgeTail != keyEdgeHead) {
+     len = keyEdges[keyEdgeTail & KEY_EDGE_MASK].at - keyLastAt;
+     keyLastAt = keyEdges[keyEdgeTail & KEY_EDGE_MASK].at;
+     down = keyEdges[keyEdgeTail & KEY_EDGE_MASK].down;
+     keyEdgeTail++;
+     if (down == keyIsDown)
+        continue;                   // an edge was dropped, the length is meaningless
+     keyIsDown = down;
+
+     keyWindow[keyWindowPos] = len;
+     keyWindowPos = (unsigned char)((keyWindowPos + 1) % KEY_UNIT_WINDOW);
+     shortest = keyWindow[0];
+     for (i = 1; i < KEY_UNIT_WINDOW; i++)
+        if (keyWindow[i] < shortest)
+           shortest = keyWindow[i];
+     sum = 0;
+     n = 0;
+     for (i = 0; i < KEY_UNIT_WINDOW; i++)
+        if (keyWindow[i] < shortest + shortest / 2) {
+           sum += keyWindow[i];
+           n++;
+        }
+     if (n)                         // none pass with a 0 tick shortest: keep the last unit
+        keyUnit = sum / n;
+
+     if (!down) {                   // a mark ended
+        if (keyMarkCount < KEY_MARKS_MAX)
+           keyMarks[keyMarkCount] = len;
+        if (keyMarkCount <= KEY_MARKS_MAX)
+           keyMarkCount++;
+     } else {                       // a space ended
+        if (len >= 2 * keyUnit)
+           keyFlush();
+        if (len >= 5 * keyUnit && keyWordDue) {
+           keyPut(' ');
+           keyWordDue = 0;
+        }
+     }
+  }
+
+  if (!keyIsDown && TIME_DUE(keyLastAt + 2 * keyUnit, now))
+     keyFlush();
+  else if (!keyIsDown && keyMarkCount)
+     startTimer(&keyTimer, keyLastAt + 2 * keyUnit, keyDue);
+  }
+
+char keyRead(void)
+  {
+  char c;
+
+  if (keyTextTail == keyTextHead)
+     return 0;
+  c = keyText[keyTextTail & KEY_TEXT_MASK];
+  keyTextTail++;
+  return c;
+  }
+
+unsigned char keyWPM(void)
+  {
+  unsigned long wpm;
+
+  if (!keyUnit)
+     return 0;
+  wpm = TIM_TICKS(TIM_TICK_HZ) * 6UL / (5UL * keyUnit);
+  return (unsigned char)(wpm > 255 ? 255 : wpm);
+  }
+
+/*********************************************************************************
+* Function   void startKeyer(MorseFormatPtr format, unsigned char dit,
+*                            unsigned char dah, unsigned char mode)
+* REQUIREMENTS:
+*    - Key the format's sidetone from two paddles from now on (see
+*      initLAB1.h); they no longer count for the unlock
+*    - The first press starts sending, from the capture ISR
+*  Inputs:  Format, BUT_CHx_M of the dit and dah paddles, KEYER_IAMBIC_A/B
+*********************************************************************************/
+void startKeyer(MorseFormatPtr format, unsigned char dit, unsigned char dah, unsigned char mode)
+  {
+  TIE &= ~(dit | dah);
+  keyerFormat = *format;
+  keyerDit = dit;
+  keyerDah = dah;
+  keyerMode = mode;
+  keyerMemory = 0;
+  keyerSqueeze = 0;
+  keyerLast = SYM_DASH;       // a squeeze from rest starts with a dit
+  keyerPaddles = dit | dah;
+  armButtons(keyerPaddles);
+  }
+
+void stopKeyer(void)
+  {
+  TIE &= ~keyerPaddles;
+  keyerPaddles = 0;
+  keyerDit = keyerDah = 0;
+  }
+
+/*********************************************************************************
+* Function   void startReceiver(void)
+* REQUIREMENTS:
+*    - Decode the tone on ATD0 from now on (see initLAB1.h), in place of a
+*      straight key: its edges and text go through pumpKey()/keyRead()
+*    - Start the first conversion, and the sample compares after it
+*********************************************************************************/
+void startReceiver(void)
+  {
+  unsigned long now;
+
+  stopKey();
+  stopReceiver();
+  keyReset();
+  initATD();
+  rxS1 = rxS2 = 0;
+  rxCount = 0;
+  rxBlockNumber = rxLastNumber = 0;
+  rxBlockHead = rxBlockTail = 0;
+  rxBlocksSeen = 0;
+  rxPeak = rxFloor = 0;
+  rxDown = 0;
+  rxHold = 0;
+  rxActive = 1;
+  rxSampleTicks = (unsigned int)TIM_TICKS(RX_SAMPLE_TICKS);
+
+  ATD0CTL5 = RX_ATD_CHANNEL;
+  TIOS |= RX_SAMPLE;
+  now = timeNow();
+  RX_TC = (unsigned int)now + rxSampleTicks;
+  rxStartAt = now + rxSampleTicks;
+  TIM_ACK(RX_SAMPLE);
+  TIE |= RX_SAMPLE;
+  }
+
+void stopReceiver(void)
+  {
+  TIE &= ~RX_SAMPLE;
+  ATD0CTL2 = 0x00;           // powered down
+  rxActive = 0;
+  }
+
+/*********************************************************************************
+* Function   unsigned long rxPower(const struct RxBlock *block)
+* REQUIREMENTS:
+*    - Squared magnitude of the tone over a block, from the Goertzel state:
+*      s1^2 + s2^2 - coeff s1 s2, N^2 A^2 / 4 for a tone of amplitude A
+*********************************************************************************/
+unsigned long rxPower(const struct RxBlock *block)
+  {
+  long s1 = block -> s1, s2 = block -> s2;
+  long p = s1 * s1 + s2 * s2 - ((RX_COEFF * s1) >> 14) * s2;
+
+  return p > 0 ? (unsigned long)p : 0;
+  }
+
+// Integer square root, one result bit per pass
+static unsigned long rxSqrt(unsigned long x)
+  {
+  unsigned long root = 0, bit = 1UL << 30;
+
+  while (bit > x)
+     bit >>= 2;
+  while (bit) {
+     if (x >= root + bit) {
+        x -= root + bit;
+        root = (root >> 1) + bit;
+     } else {
+        root >>= 1;
+     }
+     bit >>= 2;
+  }
+  return root;
+  }
+
+/*********************************************************************************
+* Function   void pumpReceiver(void)
+* REQUIREMENTS:
+*    - Take the sampled blocks from rxBlocks[]: magnitude of the tone, peak
+*      and floor tracking, key-down/key-up against the threshold between
+*      them; the floor only follows blocks below the threshold
+*    - An edge takes RX_HOLD_BLOCKS blocks in a row: a noise spike is not a
+*      dot. Queue it in keyEdges[] at the end time of the first of them;
+*      blocks the ISR had to drop still count for the time
+*  Call from the main loop, before pumpKey(); returns at once without a receiver.
+*********************************************************************************/
+void pumpReceiver(void)
+  {
+  struct RxBlock block;
+  unsigned long mag, span;
+  unsigned char down;
+
+  if (!rxActive)
+     return;
+
+  while (rxBlockTail != rxBlockHead) {
+     block = rxBlocks[rxBlockTail & RX_BLOCK_MASK];
+     rxBlockTail++;
+     rxBlocksSeen += (unsigned int)(block.number - rxLastNumber);
+     rxLastNumber = block.number;
+
+     mag = rxSqrt(rxPower(&block));
+     if (rxPeak == 0)
+        rxFloor = rxPeak = mag;            // the first block: noise, presumably
+     if (mag > rxPeak)
+        rxPeak = mag;
+     else
+        rxPeak -= (rxPeak - rxFloor) >> RX_PEAK_DECAY;
+
+     // Squelch: no tone unless the peak stands well clear of the noise
+     span = rxPeak - rxFloor;
+     if (span < (RX_SQUELCH - 1) * rxFloor + RX_MIN_MAG)
+        down = 0;
+     else if (rxDown)
+        down = mag > rxFloor + span * 3 / 8;
+     else
+        down = mag > rxFloor + span * 5 / 8;
+
+     // The floor follows the blocks without the tone
+     if (!down) {
+        if (mag < rxFloor)
+           rxFloor -= (rxFloor - mag) >> 3;
+        else
+           rxFloor += (mag - rxFloor) >> 3;
+     }
+
+     if (down == rxDown) {
+        rxHold = 0;
+     } else if (++rxHold == RX_HOLD_BLOCKS) {
+        rxDown = down;
+        rxHold = 0;
+        keyQueueEdge(rxStartAt + (rxBlocksSeen - (RX_HOLD_BLOCKS - 1)) * RX_BLOCK_TICKS -
+                     rxSampleTicks, down);
+     }
+  }
+  }
+  
+/*********************************************************************************
+* Function   static unsigned char laneChar(struct Lane *lane, unsigned char *word)
+* REQUIREMENTS:
+*    - Take the lane's next sendable character into code and elements, as
+*      pumpText() does: lower case as upper case, the others skipped
+*    - Set *word if spaces came before it
+*  Outputs: 0 at the end of the text
+*********************************************************************************/
+static unsigned char laneChar(struct Lane *lane, unsigned char *word)
+  {
+  unsigned char code, n;
+  char c;
+
+  while ((c = *lane->text) != 0) {
+     lane->text++;
+     if (c == ' ') {
+        *word = 1;
+        continue;
+     }
+     if (c >= 'a' && c <= 'z')
+        c -= 'a' - 'A';
+     code = (c >= 0x20 && c < 0x60) ? MORSE_ASCII[c - 0x20] : 0;
+     if (code == 0)
+        continue;
+
+     for (n = 7; !(code & (1 << n)); n--)
+        ;
+     lane->code = code;
+     lane->elements = n;
+     return 1;
+  }
+  return 0;
+  }
+
+/*********************************************************************************
+* Function   static void laneAdvance(struct Lane *lane)
+* REQUIREMENTS:
+*    - The lane's transition is due: a mark ends in the gap between
+*      elements, or the letter or word gap before its next character, or
+*      the lane ends (text 0); a gap ends in the character's next element
+*    - Schedule the next transition from this one, with the lane's timing
+*********************************************************************************/
+static void laneAdvance(struct Lane *lane)
+  {
+  unsigned char word = 0;
+
+  if (!lane->on) {
+     lane->on = 1;
+     lane->elements--;
+     lane->next += (lane->code & (1 << lane->elements)) ? lane->timing.dashTicks
+                                                         : lane->timing.dotTicks;
+     return;
+  }
+
+  lane->on = 0;
+  if (lane->elements)
+     lane->next += lane->timing.gapTicks;
+  else if (laneChar(lane, &word))
+     lane->next += word ? lane->timing.wordTicks : lane->timing.letterTicks;
+  else
+     lane->text = 0;
+  }
+
+/*********************************************************************************
+* Function   static void laneStep(struct Timer *timer)
+* REQUIREMENTS:
+*    - laneTimer's callback: advance every lane that is due
+*    - Write the LEDs of all the lanes in one PTM store
+*    - Re-arm laneTimer at the earliest next transition, none once every
+*      lane has ended
+*********************************************************************************/
+static void laneStep(struct Timer *timer)
+  {
+  struct Lane *lane;
+  unsigned long now = timeNow(), first = 0;
+  unsigned char i, leds = 0, busy = 0;
+
+  for (i = 0, lane = lanes; i < LANE_COUNT; i++, lane++) {
+     if (lane->text && TIME_DUE(lane->next, now))
+        laneAdvance(lane);
+     if (!lane->text)
+        continue;
+     if (lane->on)
+        leds |= (unsigned char)(LED1 >> i);
+     if (!busy++ || (long)(lane->next - first) < 0)
+        first = lane->next;
+  }
+
+  SET_LEDS(leds);
+  if (busy)
+     startTimer(timer, first, laneStep);
+  }
+
+/*********************************************************************************
+* Function   unsigned char startLane(unsigned char lane, const char *text,
+*                                    unsigned char wpm)
+* REQUIREMENTS:
+*    - Send the text on LED1 >> lane at wpm, from LANE_LEAD ticks on,
+*      whatever the other lanes are sending; a lane still sending starts
+*      over with the new text
+*    - Move laneTimer earlier if this lane's first mark comes first
+*    - The string is read as it is sent and must stay valid until then
+*    - From main, not while code is being sent
+*  Outputs: 1 if started, 0 if out of range or code is being sent
+*********************************************************************************/
+unsigned char startLane(unsigned char lane, const char *text, unsigned char wpm)
+  {
+  struct MorseTiming timing;
+  struct Lane *l = &lanes[lane];
+  unsigned char word, ccr;
+
+  if (lane >= LANE_COUNT || wpm == 0 || codeActive)
+     return 0;
+  fillTiming(&timing, wpm, wpm, MORSE_DASH_WEIGHT);
+  // laneTimer deadlines are in the ticks the TIM counts (crystal fallback)
+  timing.dotTicks    = TIM_TICKS(timing.dotTicks);
+  timing.dashTicks   = TIM_TICKS(timing.dashTicks);
+  timing.gapTicks    = TIM_TICKS(timing.gapTicks);
+  timing.letterTicks = TIM_TICKS(timing.letterTicks);
+  timing.wordTicks   = TIM_TICKS(timing.wordTicks);
+
+  MASK_INTERRUPTS(ccr);
+  l->timing = timing;
+  l->text = text;
+  l->on = 0;
+  if (!laneChar(l, &word)) {
+     l->text = 0;
+  } else {
+     l->next = timeNow() + LANE_LEAD;
+     if (!laneTimer.prev || (long)(l->next - laneTimer.deadline) < 0)
+        timerInsert(&laneTimer, l->next, laneStep);
+  }
+  RESTORE_INTERRUPTS(ccr);
+  return 1;
+  }
+
+void stopLanes(void)
+  {
+  unsigned char i, ccr;
+
+  MASK_INTERRUPTS(ccr);
+  timerRemove(&laneTimer);
+  for (i = 0; i < LANE_COUNT; i++)
+     lanes[i].text = 0;
+  SET_LEDS(LEDSOFF);
+  RESTORE_INTERRUPTS(ccr);
+  }
+
+unsigned char lanesBusy(void)
+  {
+  unsigned char i, leds = 0;
+
+  for (i = 0; i < LANE_COUNT; i++)
+     if (lanes[i].text)
+        leds |= (unsigned char)(LED1 >> i);
+  return leds;
+  }
+
+/*********************************************************************************
+* Function   unsigned char waitEvent(void)
+* REQUIREMENTS:
+*    - Hand out the oldest event the ISRs have posted, so that it can be
+*      posted again while main does its work
+*    - Idle in WAI until there is one; only the check of the queue runs
+*      with interrupts masked, and IDLE_WAIT() opens them with the WAI
+*  Call from main only: its event loop.
+*  Outputs: EVENT_TEXT..EVENT_UNLOCKED
+*********************************************************************************/
+unsigned char waitEvent(void)
+  {
+  unsigned char event;
+
+  DisableInterrupts;
+  while (eventTail == eventHead) {
+     IDLE_WAIT();
+     DisableInterrupts;
+  }
+  EnableInterrupts;
+
+  event = eventQueue[eventTail & EVENT_QUEUE_MASK];
+  eventTail++;
+  eventQueued[event] = 0;
+  return event;
+  }
+
+/*********************************************************************************
+* Function   void queueEvent(unsigned char event)
+* REQUIREMENTS:
+*    - postEvent() from main and from the timer callbacks, with interrupts
+*      masked for it, then the caller's I bit restored
+*********************************************************************************/
+void queueEvent(unsigned char event)
+  {
+  unsigned char ccr;
+
+  MASK_INTERRUPTS(ccr);
+  postEvent(event);
+  RESTORE_INTERRUPTS(ccr);
+  }
+
+#pragma CODE_SEG __NEAR_SEG HOT_ROM
+/*********************************************************************************
+* Function   void postEvent(unsigned char event)
+* REQUIREMENTS:
+*    - Queue the event for waitEvent(), unless it is queued already
+*    - With the I bit set (an ISR); from main, queueEvent()
+*********************************************************************************/
+void postEvent(unsigned char event)
+  {
+  if (eventQueued[event])
+     return;
+  eventQueued[event] = 1;
+  eventQueue[eventHead & EVENT_QUEUE_MASK] = event;
+  eventHead++;
+  }
+
+#if TONE_BACKEND == TONE_BACKEND_PWM
+/*********************************************************************************
+* Function   void setTone(unsigned long tone)
+* REQUIREMENTS: 
+*    - Play a square wave of the given half-period (16.16 TIM ticks) on PP7,
+*      rounded to a whole bus cycle of period, or silence the speaker if the
+*      tone is blank
+*  Inputs:  Tone half-period, as in struct MorseCode
+*  Outputs: Square wave on PP7
+*********************************************************************************/                    
+void setTone(unsigned long tone)
+  {
+  unsigned int period;
+
+  if (tone == blank) {
+  
+     PWME &= ~PWME_PWME7_MASK;
+     
+  } else {
+  
+     // Period and duty are double buffered: a running tone changes at its next period
+     period = (unsigned int)((tone + (1UL << (PWM_TONE_SHIFT - 1))) >> PWM_TONE_SHIFT);
+     PWMPER67 = period;
+     PWMDTY67 = period >> 1;
+     PWME |= PWME_PWME7_MASK;
+     
+  }
+  }
+#endif
+
+/*********************************************************************************
+* Function   void sendCode(void)
+* REQUIREMENTS: 
+*    - Make the decoded first element current, decode the one after it
+* Uses the current element to
+*    - Set tone value in SPEAKER_TC
+*    - Set duration value in DURATION_TC
+*    - Set LED pattern for current tone
+*    and
+*    - Enable interrupts for Speaker and Duration channels 
+*    - Clear interrupt flags for Speaker and Duration channels
+*    - Enable Speaker toggle without affecting other channels    
+*    (Duration channel only if the code starts with a blank element)
+*  Inputs: none      
+*  Outputs: LED pattern for note and tone heard on speaker.   
+*********************************************************************************/                    
+void sendCode(void)
+  {             
+  unsigned char channels = TONE_CHANNELS;
+#if TONE_BACKEND == TONE_BACKEND_OC
+  unsigned int step;
+#endif
+
+  //Nothing to send
+  if (!nextReady) {
+     stopCode();
+     return;
+  }
+
+  // First element, and the one after it decoded ahead as toneDurationISR keeps it
+  currentElement = nextElement;
+  durationExtra = nextExtra;
+  nextReady = nextCode() || nextMessage();
+
+#if TONE_BACKEND == TONE_BACKEND_PWM
+  //Start the PWM tone
+  setTone(currentElement.tone);
+#else
+  //Set tone value in SPEAKER_TC. A code that starts with a gap leaves the
+  //speaker channel off, toneDurationISR turns it on with the first tone.
+  tonePhase = 0;
+  if (currentElement.tone == blank) {
+     channels = TONEDURATION;
+  } else {
+     NEXT_HALF_PERIOD(step);
+     if (codeSource == SOURCE_KEYER)
+        step = KEYER_LEAD;       // sidetone: first toggle right away
+     SPEAKER_TC = step + TCNT;   //TCNT
+  }
+#endif
+  
+  //Set duration value in DURATION_TC
+  DURATION_TC = currentElement.duration + TCNT;	
+  
+  //Set LED pattern for current tone
+  SET_LEDS(currentElement.leds);  
+
+  //Enable interrupts for Speaker and Duration channels 
+  TIE |= channels;
+
+  //Clear interrupt flags for Speaker and Duration channels
+  TIM_ACK(channels);  
+  
+#if TONE_BACKEND == TONE_BACKEND_OC
+  //Enable Speaker toggle without affecting other channels
+  if (channels & SPEAKER)
+     TCTL2 |= SPKR_ON;
+#endif
+
+  codeActive = 1;
+  }
+  
+ 
+  
+/********************************************************************************* 
+* Function   void stopCode(void) 
+* REQUIREMENTS: 
+*    - Disable speaker and duration interrupts,
+*    - Clear speaker and duration interrupt flags,
+*    - Disable speaker toggling (turns off speaker),
+*    - Turn ON all LEDs to indicate end of code,
+*    - Arm the buttons for the unlock sequence (see buttonEdge)
+*  Inputs:  none
+*  Outputs: All LEDs are turned ON.  
+*********************************************************************************/                
+void stopCode(void)
+  {
+
+  //Disable speaker and duration interrupts,
+  TIE &= ~(TONE_CHANNELS);
+  
+  //Clear speaker and duration interrupt flags,
+  TIM_ACK(TONE_CHANNELS);
+  
+  //Disable speaker toggling (turns off speaker),
+#if TONE_BACKEND == TONE_BACKEND_PWM
+  PWME &= ~PWME_PWME7_MASK;
+#else
+  TCTL2 &= SPKR_OFF;
+#endif
+  
+  //Turn ON all LEDs to indicate end of code,
+  SET_LEDS(~LEDSOFF);
+  codeActive = 0;
+  
+  // Arming all four buttons for the unlock sequence - any of them may be
+  // pressed, right or wrong. (a straight key, paddles and an alarm on TC1
+  // stay armed)
+  unlockStep = 0;
+  armButtons(BUTTONS_M & ~(keyButton | keyerPaddles));
+
+  } 
+
+/*********************************************************************************
+* Function   static void armButtons(unsigned char mask)
+* REQUIREMENTS:
+*    - Take the buttons in mask as they are now, each one settled: its first
+*      edge is taken at once (see buttonEdge)
+*    - Capture both edges, clear the flags and arm the interrupts
+*  Inputs:  BUT_CHx_M of the buttons
+*********************************************************************************/
+static void armButtons(unsigned char mask)
+  {
+  unsigned long now;
+  unsigned char i;
+
+  buttonsDown = (unsigned char)((buttonsDown & ~mask) | (~PTT & mask));
+  now = timeNow() - BUTTON_DEBOUNCE_TICKS;
+  for (i = 0; i < 4; i++)
+     if (mask & (BUT_CH4_M << i))
+        buttonChange[i] = now;
+
+  // Here, set button ISRs to detect and run on both edges, for the debounce
+  TCTL3 = BUTTON_EDGES;
+  
+  // Clear button channel interrupt flags
+  TIM_ACK(mask);
+  TIE |= mask;
+  }
+#pragma CODE_SEG DEFAULT
+
+// unlockTimer: an unfinished unlock sequence times out
+static void unlockExpired(struct Timer *timer)
+  {
+  (void)timer;
+  if (unlockStep) {
+     unlockStep = 0;
+     SET_LEDS(UNLOCK_LOCKED_LEDS);
+  }
+  }
+ 
+#if ISR_PROFILE
+/*********************************************************************************
+* Function   void resetIsrStats(void)
+* REQUIREMENTS:
+*    - Empty isrStats[], minimums start high so the first run sets them
+*    - Leaves the I bit alone (initTIM() calls it); from main, an ISR ending
+*      during the reset may leave one sample in its row
+*********************************************************************************/
+void resetIsrStats(void)
+  {
+  unsigned char id;
+
+  for (id = 0; id < ISR_ID_COUNT; id++) {
+     isrStats[id].calls = 0;
+     isrStats[id].minCycles = 0xFFFF;
+     isrStats[id].maxCycles = 0;
+     isrStats[id].sumCycles = 0;
+     isrStats[id].minLatency = 0xFFFF;
+     isrStats[id].maxLatency = 0;
+     isrStats[id].sumLatency = 0;
+  }
+  }
+
+// Right-aligned decimal in a field of width characters
+static void putNumber(void (*put)(char), unsigned long value, unsigned char width)
+  {
+  char digits[10];
+  unsigned char n = 0;
+
+  do {
+     digits[n++] = (char)('0' + value % 10);
+     value /= 10;
+  } while (value);
+  while (width-- > n)
+     put(' ');
+  while (n)
+     put(digits[--n]);
+  }
+
+static void putString(void (*put)(char), const char *text)
+  {
+  while (*text)
+     put(*text++);
+  }
+
+/*********************************************************************************
+* Function   void dumpIsrStats(void (*put)(char))
+* REQUIREMENTS:
+*    - Print one line per ISR that has run: calls, min/max/mean execution
+*      time in bus cycles, min/max/mean entry latency in TIM ticks
+*    - Copy each row with interrupts masked, so no sum is torn by an ISR,
+*      and give the caller back its I bit after each
+*    - Call from main; put may be sciPutChar
+*  Inputs:  character output function
+*********************************************************************************/
+void dumpIsrStats(void (*put)(char))
+  {
+  static const char *const names[ISR_ID_COUNT] =
+    { "TONE   ", "ALARM  ", "RX     ", "SPEAKER", "SW1    ", "SW2    ", "SW3    ", "SW4    ",
+      "TOF    " };
+  struct IsrStats row;
+  unsigned char id, ccr;
+
+  putString(put, "ISR         calls  cyc min  max mean  lat min  max mean\r\n");
+  for (id = 0; id < ISR_ID_COUNT; id++) {
+     MASK_INTERRUPTS(ccr);
+     row = isrStats[id];
+     RESTORE_INTERRUPTS(ccr);
+     if (row.calls == 0)
+        continue;
+
+     putString(put, names[id]);
+     putNumber(put, row.calls, 11);
+     putNumber(put, row.minCycles, 9);
+     putNumber(put, row.maxCycles, 5);
+     putNumber(put, row.sumCycles / row.calls, 5);
+     putNumber(put, row.minLatency, 9);
+     putNumber(put, row.maxLatency, 5);
+     putNumber(put, row.sumLatency / row.calls, 5);
+     putString(put, "\r\n");
+  }
+  }
+#endif
+ 
+/****** Start of PRAGMA and ISRs ******/
+#pragma CODE_SEG __NEAR_SEG HOT_ROM
+
+#if ISR_PROFILE
+/********************************************************************************
+*  Function: void isrRecord(unsigned char id)
+*  REQUIREMENTS:
+*    - ISR_EXIT of the ISR id: add the cycles since its ISR_ENTER and its
+*      entry latency to isrStats[id]
+*    - Both counters are 16 bits; masked, as int is wider on the host
+********************************************************************************/
+void isrRecord(unsigned char id)
+  {
+  unsigned int cycles = (isrEntry[id] - MCCNT) & 0xFFFFU;   // MCCNT counts down
+  unsigned int late = isrLate[id] & 0xFFFFU;
+  struct IsrStats *stats = &isrStats[id];
+
+  stats -> calls++;
+  stats -> sumCycles += cycles;
+  stats -> sumLatency += late;
+  if (cycles < stats -> minCycles)
+     stats -> minCycles = cycles;
+  if (cycles > stats -> maxCycles)
+     stats -> maxCycles = cycles;
+  if (late < stats -> minLatency)
+     stats -> minLatency = late;
+  if (late > stats -> maxLatency)
+     stats -> maxLatency = late;
+  }
+#endif
+
+/********************************************************************************
+*  Function: unsigned char loadCode(void)
+*  REQUIREMENTS:
+*    - Copy the table element at currentCode into nextElement
+*  Outputs: 0 at the end of code (brk), 1 otherwise
+********************************************************************************/
+static unsigned char loadCode(void)
+  {
+  const struct MorseCode *code = MORSE_NEAR(const struct MorseCode *, currentCode);
+  unsigned char page, loaded = 0;
+
+  MORSE_MAP(currentCode, page);
+  if (code -> tone != brk) {
+     nextElement.tone = TIM_TICKS(code -> tone);
+     nextElement.leds = code -> leds;
+     loadDuration(code -> duration);
+     loaded = 1;
+  }
+  MORSE_UNMAP(page);
+  return loaded;
+  }
+
+/********************************************************************************
+*  Function: void loadDuration(unsigned long ticks)
+*  REQUIREMENTS:
+*    - Set the duration of nextElement, nominal ticks to TIM_TICKS(); what
+*      does not fit one 16-bit compare is left in nextExtra for
+*      toneDurationISR to chain
+********************************************************************************/
+static void loadDuration(unsigned long ticks)
+  {
+  ticks = TIM_TICKS(ticks);
+  if (ticks > 0xFFFFUL) {
+     nextElement.duration = TIME_CHUNK;
+     nextExtra = ticks - TIME_CHUNK;
+  } else {
+     nextElement.duration = (unsigned int)ticks;
+     nextExtra = 0;
+  }
+  }
+
+/********************************************************************************
+*  Function: unsigned char peekSymbol(void)
+*  REQUIREMENTS:
+*    - Return the next symbol of the packed stream or of the text FIFO,
+*      without consuming it (dropSymbol does that)
+*  Outputs: SYM_DOT..SYM_WORD, SYM_END or SYM_WAIT
+********************************************************************************/
+static unsigned char peekSymbol(void)
+  {
+  unsigned char page, packed;
+
+  if (codeSource == SOURCE_STREAM) {
+     if (streamPos >= streamLength)
+        return SYM_END;
+     MORSE_MAP(streamSymbols, page);
+     packed = MORSE_NEAR(const unsigned char *, streamSymbols)[streamPos >> 2];
+     MORSE_UNMAP(page);
+     return (packed >> ((3 - (streamPos & 3)) << 1)) & 0x03;
+  }
+  if (textTail != textHead)
+    return textFifo[textTail & TEXT_FIFO_MASK];
+  return textDone ? SYM_END : SYM_WAIT;
+  }
+
+#define dropSymbol() \
+  do { if (codeSource == SOURCE_STREAM) streamPos++; else textTail++; } while (0)
+
+/********************************************************************************
+*  Function: unsigned char nextSymbol(void)
+*  REQUIREMENTS:
+*    - Decode the next element of the stream or text into nextElement:
+*      a dot or dash, or the gap following one. Constant time: one symbol
+*      read, plus one look-ahead to see whether the gap is a letter/word gap.
+*      Durations are only loaded from the precomputed timing, never computed
+*  Outputs: 0 at the end of the stream, 1 otherwise
+********************************************************************************/
+static unsigned char nextSymbol(void)
+  {
+  unsigned char sym;
+  const struct MorseTiming *timing = timingOverride ? timingOverride : &msgFormat.timing;
+
+  nextElement.tone = blank;
+  nextElement.leds = LEDSOFF;
+  loadDuration(timing -> gapTicks);
+
+  if (gapDue) {
+  
+     // Gap after a dot/dash; a following gap symbol lengthens it
+     gapDue = 0;
+     sym = peekSymbol();
+     if (sym == SYM_LETTER) {
+        loadDuration(timing -> letterTicks);
+        dropSymbol();
+     } else if (sym == SYM_WORD) {
+        loadDuration(timing -> wordTicks);
+        dropSymbol();
+     }
+     return 1;
+  }
+
+  sym = peekSymbol();
+  if (sym == SYM_END)
+     return 0;
+  if (sym == SYM_WAIT)
+     return 1;               // encoder behind: stay silent for one gap and retry
+  dropSymbol();
+
+  if (sym == SYM_DOT) {
+     nextElement.tone = TIM_TICKS(msgFormat.dotTone);
+     loadDuration(timing -> dotTicks);
+     nextElement.leds = msgFormat.dotLEDs;
+     gapDue = 1;
+  } else if (sym == SYM_DASH) {
+     nextElement.tone = TIM_TICKS(msgFormat.dashTone);
+     loadDuration(timing -> dashTicks);
+     nextElement.leds = msgFormat.dashLEDs;
+     gapDue = 1;
+  } else {
+     // gap symbol with no dot/dash before it, e.g. a leading word gap
+     loadDuration((sym == SYM_LETTER) ? timing -> letterTicks : timing -> wordTicks);
+  }
+  return 1;
+  }
+
+/********************************************************************************
+*  Function: unsigned char nextCode(void)
+*  REQUIREMENTS:
+*    - Move to the next element of whichever source is being sent
+*  Outputs: 0 at the end of code, 1 otherwise
+********************************************************************************/
+static unsigned char nextCode(void)
+  {
+  const struct MorseTiming *timing;
+
+  if (codeSource == SOURCE_PAUSE)
+    return 0;
+  if (codeSource == SOURCE_KEYER) {
+    // The gap after a dit/dah; the element after the gap is only decided
+    // at its end, by keyerNext() from toneDurationISR
+    if (!gapDue)
+      return 0;
+    gapDue = 0;
+    timing = timingOverride ? timingOverride : &msgFormat.timing;
+    nextElement.tone = blank;
+    nextElement.leds = LEDSOFF;
+    loadDuration(timing -> gapTicks);
+    return 1;
+  }
+  if (codeSource != SOURCE_TABLE)
+    return nextSymbol();
+  currentCode++;
+  return loadCode();
+  }
+
+/********************************************************************************
+*  Function: unsigned char keyerNext(void)
+*  REQUIREMENTS:
+*    - Decide the keyer's next element from the paddles held and remembered:
+*      both alternate with the last one, one repeats its own, none ends
+*    - Iambic B: a squeeze during the last element adds the alternate one
+*    - Load it into nextElement, with its gap due after it
+*  Outputs: 0 if no paddle asks for an element, 1 with it loaded
+********************************************************************************/
+static unsigned char keyerNext(void)
+  {
+  unsigned char want = (unsigned char)((buttonsDown & keyerPaddles) | keyerMemory);
+  unsigned char sym;
+  const struct MorseTiming *timing = timingOverride ? timingOverride : &msgFormat.timing;
+
+  if (keyerSqueeze && keyerMode == KEYER_IAMBIC_B)
+     want |= (keyerLast == SYM_DOT) ? keyerDah : keyerDit;
+  if (!want)
+     return 0;
+
+  if (want == keyerPaddles)
+     sym = (keyerLast == SYM_DOT) ? SYM_DASH : SYM_DOT;
+  else
+     sym = (want & keyerDit) ? SYM_DOT : SYM_DASH;
+  keyerLast = sym;
+  keyerMemory &= (unsigned char)~((sym == SYM_DOT) ? keyerDit : keyerDah);
+  keyerSqueeze = (buttonsDown & keyerPaddles) == keyerPaddles;
+
+  if (sym == SYM_DOT) {
+     nextElement.tone = TIM_TICKS(msgFormat.dotTone);
+     loadDuration(timing -> dotTicks);
+     nextElement.leds = msgFormat.dotLEDs;
+  } else {
+     nextElement.tone = TIM_TICKS(msgFormat.dashTone);
+     loadDuration(timing -> dashTicks);
+     nextElement.leds = msgFormat.dashLEDs;
+  }
+  gapDue = 1;
+  return 1;
+  }
+
+/********************************************************************************
+*  Function: void keyerStart(void)
+*  REQUIREMENTS:
+*    - A paddle press with nothing being sent: start the keyer's first
+*      element now, from the capture ISR (see buttonEdge)
+********************************************************************************/
+static void keyerStart(void)
+  {
+  initChannels();
+  msgFormat = keyerFormat;
+  codeSource = SOURCE_KEYER;
+  gapDue = 0;
+  keyerSqueeze = 0;
+  nextReady = keyerNext();
+  sendCode();
+  }
+
+/********************************************************************************
+*  Function: unsigned char beginMessage(const struct MorseMessage *msg)
+*  REQUIREMENTS:
+*    - Point the table, stream or text source at the message and decode
+*      its first element into nextElement
+*    - Text messages get their first characters encoded here, so a text
+*      queued behind another message starts without waiting for pumpText().
+*      When called from the ISR the text before it has been fully encoded
+*      (textDone), so main is no longer inside pumpText() for it.
+*  Outputs: 0 if the message has nothing to send, 1 otherwise
+********************************************************************************/
+static unsigned char beginMessage(const struct MorseMessage *msg)
+  {
+  gapDue = 0;
+
+  if (msg -> kind == MSG_PAUSE) {
+     nextElement.tone = blank;
+     nextElement.leds = LEDSOFF;
+     loadDuration(msg -> ticks);
+     codeSource = SOURCE_PAUSE;
+     return msg -> ticks != 0;
+  }
+
+  if (msg -> kind == MSG_TABLE) {
+     codeStart = msg -> code;
+     currentCode = msg -> code;
+     codeSource = SOURCE_TABLE;
+     return loadCode();
+  }
+
+  if (msg -> kind == MSG_STREAM) {
+     msgFormat = msg -> stream -> format;
+     streamSymbols = msg -> stream -> symbols;
+     streamLength = msg -> stream -> length;
+     streamPos = 0;
+     codeSource = SOURCE_STREAM;
+     return nextSymbol();
+  }
+
+  if (msg -> kind == MSG_TEXT) {
+     textString = msg -> text;
+     textSource = nextStringChar;
+  } else {
+     textSource = msg -> source;
+  }
+  textHead = 0;
+  textTail = 0;
+  textDone = 0;
+  textGap = 0;
+  msgFormat = *msg -> format;
+  codeSource = SOURCE_TEXT;
+  pumpText();
+  return nextSymbol();
+  }
+
+/********************************************************************************
+*  Function: unsigned char nextMessage(void)
+*  REQUIREMENTS:
+*    - Take messages off the transmit queue until one has something to send
+*  Outputs: 0 if the queue ran empty, 1 with the first element loaded
+********************************************************************************/
+static unsigned char nextMessage(void)
+  {
+  unsigned char loaded;
+
+  while (queueTail != queueHead) {
+     loaded = beginMessage(&msgQueue[queueTail & MSG_QUEUE_MASK]);
+     queueTail++;            // slot is free once the descriptor has been read
+     if (loaded)
+        return 1;
+  }
+  return 0;
+  }
+
+/********************************************************************************
+*  ISR:  toneDurationISR - is called whenever TCNT hits DURATION_TC.      
+*
+*       
+*  REQUIREMENTS:
+*    - Chain another compare if the element is longer than 16 bits
+*    - Clear duration interrupt flag
+*    - Switch to the next code element, decoded ahead
+*    - If end of code reached and nothing is queued, stop sending code
+*      else 
+*    - Update tone, duration and LED pattern for current code; a blank
+*      element switches the speaker toggle and its interrupt off itself
+*    - Decode the element after it (at the end of the code, the first one
+*      of the next queued message), preemptible by SpeakerISR (NEST_TONE)
+*    - Post EVENT_TEXT once the text FIFO has room for another character
+*  Inputs: None       
+*  Outputs:LED pattern for current code
+********************************************************************************  */          
+
+void interrupt VectorNumber_Vtimch0 toneDurationISR(void)
+  {
+     unsigned int step;
+
+     ISR_ENTER(ISR_ID_TONE, DURATION_TC);
+
+     // Element longer than one compare: keep it going for another step
+     if (durationExtra) {
+        step = (durationExtra > 0xFFFFUL) ? TIME_CHUNK : (unsigned int)durationExtra;
+        durationExtra -= step;
+#if ABSOLUTE_SCHEDULING
+        DURATION_TC += step;
+#else
+        DURATION_TC = step + TCNT;
+#endif
+        // TC0 bit only: a TC3 flag pending under this ISR must survive the
+        // chained compare, or SpeakerISR misses a half-period
+        TIM_ACK(TONEDURATION);
+        ISR_EXIT(ISR_ID_TONE);
+        return;
+     }
+     
+     // Clear duration's interrupt flag first, TC0 mustn't come back in below
+     TIM_ACK(TONEDURATION);
+
+     // The next element was decoded ahead. At the end of the code, a message
+     // queued since then still starts from this same compare: no dead air.
+     // The keyer decides its next element only now, at the end of the gap.
+     if (!nextReady && codeSource == SOURCE_KEYER)
+        nextReady = keyerNext();
+     if (!nextReady)
+        nextReady = nextMessage();
+
+     // If the end of the code was reached with nothing queued, stop sending the code
+     if (!nextReady) {
+     
+        stopCode();
+        
+     } else {  // Otherwise, prep for next duration interrupt...
+     
+        // update the tone, duration, and LED pattern to that of current code.
+        currentElement = nextElement;
+        durationExtra = nextExtra;
+        // In absolute mode the element starts exactly at the compare that just fired.
+#if TONE_BACKEND == TONE_BACKEND_PWM
+        setTone(currentElement.tone);
+#else
+        if (currentElement.tone == blank) {
+           // A gap: stop the toggle and the speaker compare here. Left to
+           // SpeakerISR, a 0 tick half-period would only match a TCNT wrap later.
+           TCTL2 &= SPKR_OFF;
+           TIE &= ~SPEAKER;
+        } else {
+           NEXT_HALF_PERIOD(step);
+#if ABSOLUTE_SCHEDULING
+           SPEAKER_TC = DURATION_TC + step;
+#else
+           SPEAKER_TC = step + TCNT;
+#endif
+           // First tone after a gap: the speaker channel comes back on
+           if (!(TIE & SPEAKER)) {
+              TIM_ACK(SPEAKER);
+              TIE |= SPEAKER;
+              TCTL2 |= SPKR_ON;
+           }
+        }
+#endif
+#if ABSOLUTE_SCHEDULING
+        DURATION_TC += currentElement.duration;
+#else
+        DURATION_TC = currentElement.duration + TCNT;
+#endif
+        SET_LEDS(currentElement.leds);  
+
+        // Then decode the element after it. That is the long part: interrupts
+        // go back on for it, and SpeakerISR only reads currentElement.
+        ISR_NEST_OPEN(NEST_TONE);
+        nextReady = nextCode() || (codeSource != SOURCE_KEYER && nextMessage());
+        ISR_NEST_CLOSE(NEST_TONE);
+
+        if (codeSource == SOURCE_TEXT && !textDone &&
+            (unsigned char)(TEXT_FIFO_SIZE - (unsigned char)(textHead - textTail)) >= TEXT_CHAR_MAX)
+           postEvent(EVENT_TEXT);
+     }
+
+     ISR_EXIT(ISR_ID_TONE);
+  }                                 
+
+/********************************************************************************
+*  ISR: SpeakerISR
+*  REQUIREMENTS:
+*     - If tone is blank, turn off speaker toggle  
+*        else
+*     - Turn on speaker toggle
+*     - Clear speaker interrupt flag,
+*     - Update speaker half-period to continue with current tone, n or n+1
+*       ticks so the mean half-period matches the fractional tone
+*  Outputs: Current cone continues to be sent 
+*  Not used with the PWM tone backend.
+*********************************************************************************/           
+
+#if TONE_BACKEND == TONE_BACKEND_OC
+void interrupt VectorNumber_Vtimch3 SpeakerISR(void)
+  {
+     unsigned int step;
+
+     ISR_ENTER(ISR_ID_SPEAKER, SPEAKER_TC);
+
+     // Ack speakerISR's interrupt flag
+     TIM_ACK(SPEAKER);
+     
+     // If current tone is blank, turn off speaker toggle (so we don't hear anything)
+     if (currentElement.tone == blank) {
+     
+        TCTL2 &= SPKR_OFF;
+      
+     }
+     
+     else {   // Otherwise, turn on/keep playing speaker, and set the tone duration
+     
+        // Turn on speaker toggle
+        TCTL2 = (TCTL2 & 0x3F) | SPKR_ON;     
+        
+        // Update speaker with the half period of the current tone to continue making the noise
+        NEXT_HALF_PERIOD(step);
+#if ABSOLUTE_SCHEDULING
+        SPEAKER_TC += step;
+#else
+        SPEAKER_TC = step + TCNT;
+#endif
+              
+     }      
+
+     ISR_EXIT(ISR_ID_SPEAKER);
+  }   
+#endif
+
+  
+
+/********************************************************************************
+*  ISR: timerOverflowISR
+*  REQUIREMENTS:
+*     - Count TCNT wraps into the upper half of timeNow()
+*     - Clear the overflow flag
+*********************************************************************************/           
+void interrupt VectorNumber_Vtimovf timerOverflowISR(void)
+  {
+     ISR_ENTER(ISR_ID_TOF, 0);
+     TFLG2 = TFLG2_TOF_MASK;
+     timeHigh++;
+
+     ISR_EXIT(ISR_ID_TOF);
+  }
+
+/********************************************************************************
+*  Function: unsigned char rxFilter(int x)
+*  REQUIREMENTS:
+*    - One Goertzel step on a sample centred on 0:
+*      s = x + coeff s1 - s2, coeff = RX_COEFF in Q14
+*    - After RX_BLOCK samples, hand the state to pumpReceiver() through
+*      rxBlocks[] (dropped if it is full, the number still counts) and
+*      start the next block from 0
+*    - |s| stays under N A / (2 sin w): 16 bits for any tone above 100 Hz
+*  Outputs: 1 if the sample completed a block
+********************************************************************************/
+unsigned char rxFilter(int x)
+  {
+  int s = x + (int)(((long)RX_COEFF * rxS1) >> 14) - rxS2;
+
+  rxS2 = rxS1;
+  rxS1 = s;
+  if (++rxCount < RX_BLOCK)
+     return 0;
+
+  rxBlockNumber++;
+  if ((unsigned char)(rxBlockHead - rxBlockTail) < RX_BLOCK_FIFO) {
+     rxBlocks[rxBlockHead & RX_BLOCK_MASK].s1 = rxS1;
+     rxBlocks[rxBlockHead & RX_BLOCK_MASK].s2 = rxS2;
+     rxBlocks[rxBlockHead & RX_BLOCK_MASK].number = rxBlockNumber;
+     rxBlockHead++;
+  }
+  rxS1 = rxS2 = 0;
+  rxCount = 0;
+  return 1;
+  }
+
+/********************************************************************************
+*  ISR: rxSampleISR
+*  REQUIREMENTS:
+*     - Schedule the next sample rxSampleTicks after this one
+*     - Clear the sample flag
+*     - Read the conversion the last compare started (done 7 us after
+*       it), start the next one, and filter the sample (rxFilter)
+*     - Post EVENT_RX for each block it completes
+*********************************************************************************/
+void interrupt VectorNumber_Vtimch2 rxSampleISR(void)
+  {
+     ISR_ENTER(ISR_ID_RX, RX_TC);
+     RX_TC += rxSampleTicks;
+     TIM_ACK(RX_SAMPLE);
+
+     if (rxFilter((int)ATD0DR0H - 0x80))
+        postEvent(EVENT_RX);
+     ATD0CTL5 = RX_ATD_CHANNEL;
+     ISR_EXIT(ISR_ID_RX);
+  }
+
+/********************************************************************************
+*  ISR: alarmISR
+*  REQUIREMENTS:
+*     - Clear the alarm flag
+*     - Ignore the matches of ALARM_TC before the armed deadline (one per
+*       TCNT wrap)
+*     - Then, while the earliest timer is due: cascade its slot if it is
+*       above level 0, moving the clock up to the slot's start; else take
+*       it out and run its callback, preemptible by SpeakerISR (NEST_ALARM)
+*     - Arm ALARM_TC for the first timer left
+*********************************************************************************/           
+void interrupt VectorNumber_Vtimch1 alarmISR(void)
+  {
+     struct Timer *timer, *list;
+     unsigned long at;
+
+     ISR_ENTER(ISR_ID_ALARM, ALARM_TC);
+     TIM_ACK(ALARM);
+
+     if (TIME_DUE(timerArmed, timeNow())) {
+        timerRunning = 1;
+        while ((timer = timerEarliest()) != 0 && TIME_DUE(timer->deadline, timeNow())) {
+           at = (timer->deadline >> TIMER_SHIFT) & TIMER_CLOCK_MASK &
+                ~((1UL << (TIMER_BITS * (timer->slot >> TIMER_BITS))) - 1);
+           if (!TIME_DUE(at << TIMER_SHIFT, timerClock << TIMER_SHIFT))
+              timerClock = at;
+
+           if (timer->slot >= TIMER_SLOTS) {
+              list = timerWheel[timer->slot];
+              timerWheel[timer->slot] = 0;
+              timerOccupied[timer->slot >> TIMER_BITS] &= ~(1U << (timer->slot & (TIMER_SLOTS - 1)));
+              while (list) {
+                 timer = list;
+                 list = list->next;
+                 timerLink(timer);            // a level below, now
+              }
+              continue;
+           }
+
+           timerRemove(timer);
+           ISR_NEST_OPEN(NEST_ALARM);
+           timer->callback(timer);
+           ISR_NEST_CLOSE(NEST_ALARM);
+        }
+        timerRunning = 0;
+        timerArm(timer);
+     }
+     ISR_EXIT(ISR_ID_ALARM);
+  }
+
+// ----------- Button switches ISRs -------------
+
+
+/*********************************************************************************
+*  Function: static void keyQueueEdge(unsigned long at, unsigned char down)
+*  REQUIREMENTS: - Queue a key edge for pumpKey(), dropped if the queue is full
+*                - One writer only: the straight key's ISR or pumpReceiver()
+* ********************************************************************************/
+static void keyQueueEdge(unsigned long at, unsigned char down)
+  {
+  if ((unsigned char)(keyEdgeHead - keyEdgeTail) < KEY_EDGE_SIZE) {
+     keyEdges[keyEdgeHead & KEY_EDGE_MASK].at = at;
+     keyEdges[keyEdgeHead & KEY_EDGE_MASK].down = down;
+     keyEdgeHead++;
+  }
+  }
+
+/*********************************************************************************
+*  Function: static void buttonEdge(unsigned char ch, unsigned int capture)
+*  REQUIREMENTS: - Shared body of SW1_ISR..SW4_ISR
+*                - Clear the button's interrupt flag
+*                - Debounce on the captured edge times (see initLAB1.h): an
+*                  edge inside the window starts buttonTimer[] for its end
+*                - Take a settled change with buttonCommit()
+*  Inputs:  TIM channel of the button (4..7), its TCx capture
+* ********************************************************************************/
+static void buttonEdge(unsigned char ch, unsigned int capture)
+  {
+  unsigned char mask = (unsigned char)(1 << ch);
+  unsigned char down;
+  unsigned long now, edge;
+
+  TIM_ACK(mask);
+
+  // The capture is the low half of the edge time: extend it to 32 bits
+  // (16-bit wrap on any int)
+  now = timeNow();
+  edge = now - (((unsigned int)now - capture) & 0xFFFFU);
+
+  // Bounce back to the debounced state: nothing to take
+  down = (unsigned char)(~PTT & mask);
+  if (down == (buttonsDown & mask))
+     return;
+
+  // Too soon after the last change: the pin is read again when the window
+  // ends, so a tap shorter than the window still gets its release
+  if (edge - buttonChange[ch - 4] < BUTTON_DEBOUNCE_TICKS) {
+     timerInsert(&buttonTimer[ch - 4], buttonChange[ch - 4] + BUTTON_DEBOUNCE_TICKS,
+                 buttonSettled);
+     return;
+  }
+  buttonCommit(ch, down, edge);
+  }
+
+/*********************************************************************************
+*  Function: static void buttonCommit(unsigned char ch, unsigned char down,
+*                                     unsigned long edge)
+*  REQUIREMENTS: - Take a debounced change of the button, with the I bit set
+*                - A straight key's edges go to keyEdges[] (see startKey),
+*                  with EVENT_KEY
+*                - A paddle press is remembered for the keyer, and starts
+*                  it if nothing is being sent (see startKeyer)
+*                - On a press, step the unlock sequence by UNLOCK_SEQUENCE[]
+*                  and set its LEDs; on the last step, disarm the buttons
+*                  and post EVENT_UNLOCKED
+*                - Restart unlockTimer on every step of an unfinished sequence
+*  Inputs:  TIM channel of the button (4..7), its pin state (mask bit set
+*           while pressed), time of the change
+*  Outputs: LED pattern of the sequence step
+* ********************************************************************************/
+static void buttonCommit(unsigned char ch, unsigned char down, unsigned long edge)
+  {
+  unsigned char mask = (unsigned char)(1 << ch);
+
+  buttonChange[ch - 4] = edge;
+  buttonsDown ^= mask;
+
+  // A straight key: queue the edge for pumpKey(), drop it if the queue is full
+  if (mask & keyButton) {
+     keyQueueEdge(edge, down != 0);
+     postEvent(EVENT_KEY);
+     return;
+  }
+
+  if (mask & keyerPaddles) {
+     if (down) {
+        keyerMemory |= mask;
+        if ((buttonsDown & keyerPaddles) == keyerPaddles)
+           keyerSqueeze = 1;
+        if (!codeActive) {
+           keyerMemory = mask;                // none left over from a message
+           keyerStart();
+        }
+     }
+     return;
+  }
+
+  if (!down)
+     return;                                  // released
+
+  // A wrong press starts over, counting itself if it is the first button
+  if (UNLOCK_SEQUENCE[unlockStep].button == mask)
+     unlockStep++;
+  else
+     unlockStep = (UNLOCK_SEQUENCE[0].button == mask);
+
+  if (unlockStep == UNLOCK_STEPS) {
+     TIE &= ~(BUTTONS_M & ~(keyButton | keyerPaddles));  // unlocked, the key and paddles stay
+     SET_LEDS(UNLOCK_SEQUENCE[UNLOCK_STEPS - 1].leds);
+     unlockStep = 0;
+     timerRemove(&unlockTimer);
+     postEvent(EVENT_UNLOCKED);
+  } else if (unlockStep) {
+     SET_LEDS(UNLOCK_SEQUENCE[unlockStep - 1].leds);
+     timerInsert(&unlockTimer, edge + UNLOCK_TIMEOUT_TICKS, unlockExpired);
+  } else {
+     SET_LEDS(UNLOCK_LOCKED_LEDS);
+     timerRemove(&unlockTimer);
+  }
+  }
+
+
+/*********************************************************************************
+*  ISR:  SW1_ISR .. SW4_ISR
+*  REQUIREMENTS: - Pass the button's channel and capture to buttonEdge()
+*  Outputs: LED pattern of the unlock sequence
+* ********************************************************************************/           
+void interrupt VectorNumber_Vtimch4 SW1_ISR(void)
+  {
+     ISR_ENTER(ISR_ID_SW1, TC4);
+     buttonEdge(4, TC4);
+     ISR_EXIT(ISR_ID_SW1);
+  } 
+
+void interrupt VectorNumber_Vtimch5 SW2_ISR(void)
+  {
+     ISR_ENTER(ISR_ID_SW2, TC5);
+     buttonEdge(5, TC5);
+     ISR_EXIT(ISR_ID_SW2);
+  } 
+
+void interrupt VectorNumber_Vtimch6 SW3_ISR(void)
+  {
+     ISR_ENTER(ISR_ID_SW3, TC6);
+     buttonEdge(6, TC6);
+     ISR_EXIT(ISR_ID_SW3);
+  } 
+
+void interrupt VectorNumber_Vtimch7 SW4_ISR(void)
+  {
+     ISR_ENTER(ISR_ID_SW4, TC7);
+     buttonEdge(7, TC7);
+     ISR_EXIT(ISR_ID_SW4);
   }
 
    
 /****** End of PRAGMA ******/
-#pragma CODE_SEG DEFAULT 
\ No newline at end of file
+#pragma CODE_SEG DEFAULT 
+
+// buttonTimer[]: the debounce window of a button has ended, take its pin as
+// it is now. Masked: under NEST_ALARM the button ISRs could come in between.
+static void buttonSettled(struct Timer *timer)
+  {
+  unsigned char ch = (unsigned char)(timer - buttonTimer) + 4;
+  unsigned char mask = (unsigned char)(1 << ch);
+  unsigned char down, ccr;
+
+  MASK_INTERRUPTS(ccr);
+  down = (unsigned char)(~PTT & mask);
+  if ((TIE & mask) && down != (buttonsDown & mask))
+     buttonCommit(ch, down, timer->deadline);
+  RESTORE_INTERRUPTS(ccr);
+  }
@@ -29,6 +29,30 @@
 #define BUT_CH6_M     0b01000000  // TC7 mask
 #define BUT_CH5_M     0b00100000  // TC7 mask
 #define BUT_CH4_M     0b00010000  // TC7 mask
+#define BUTTONS_M     0b11110000  // TC7:4 mask
+
+// Acknowledge TIM channel flags. TFLG1 is write-1-to-clear, so writing just
+// the mask clears exactly those flags. TIM_FLAG_RMW 1 restores the old
+// TFLG1 |= mask, which reads back every pending flag and clears them all
+// (kept for the simulator's lost-interrupt comparison only).
+// TSCR1 TFFCA is not used: with it, any TCNT access also clears TOF, and
+// timeNow() and the TCNT-relative scheduling read TCNT.
+#ifndef TIM_FLAG_RMW
+#define TIM_FLAG_RMW 0
+#endif
+#if TIM_FLAG_RMW
+#define TIM_ACK(mask)  (TFLG1 |= (mask))
+#else
+#define TIM_ACK(mask)  (TFLG1 = (mask))
+#endif
+
+// Alarm compare of the 32-bit timebase, shared by the software timers
+#define ALARM_TC      TC1         // Name for TC1
+#define ALARM         0b00000010  // TC1 mask
+
+// Sample compare of the audio receiver
+#define RX_TC         TC2         // Name for TC2
+#define RX_SAMPLE     0b00000100  // TC2 mask
 
 
 // Constants used for setting active high LEDs. We've added a few extra ones for the button ISRs
@@ -40,40 +64,725 @@
 #define LED234   0x70
 #define LEDSOFF  0x00
 
-// Tone, tone duration (based on ECLK=4MHz/64) and led pattern 
-#define dot   32   // 1000 Hz tone
-#define dash  64   // 500 Hz tone
+// LED pattern written in line by the ISRs and the code they call: a store to
+// PTM instead of a far call into setLEDs(), which is cold code (see below)
+#define SET_LEDS(leds)  (PTM = (leds))
+
+/*** Bus clock ***/
+// Named clock profiles: board crystal (OSC_HZ) and bus clock (ECLK_HZ). Pick
+// one with -DCLOCK_PROFILE=CLOCK_OSC16_BUS24 etc. The PLL is referenced at
+// 4 MHz, so SYNR and REFDV follow from the two rates, and the TIM prescaler,
+// tone, duration, PWM and SCI constants below are all derived from ECLK_HZ.
+#define CLOCK_OSC4_BUS4    0   // LABS 1-3 board, PLL x1 (the original setup)
+#define CLOCK_OSC4_BUS8    1
+#define CLOCK_OSC4_BUS16   2
+#define CLOCK_OSC4_BUS24   3
+#define CLOCK_OSC16_BUS4   4   // LABS 4-7 board
+#define CLOCK_OSC16_BUS8   5
+#define CLOCK_OSC16_BUS16  6
+#define CLOCK_OSC16_BUS24  7
+
+#ifndef CLOCK_PROFILE
+#define CLOCK_PROFILE CLOCK_OSC4_BUS4
+#endif
+#if CLOCK_PROFILE < CLOCK_OSC4_BUS4 || CLOCK_PROFILE > CLOCK_OSC16_BUS24
+#error "unknown CLOCK_PROFILE"
+#endif
+
+#if CLOCK_PROFILE >= CLOCK_OSC16_BUS4
+#define OSC_HZ  16000000UL
+#else
+#define OSC_HZ   4000000UL
+#endif
+#if (CLOCK_PROFILE & 3) == 0
+#define ECLK_HZ  4000000UL
+#elif (CLOCK_PROFILE & 3) == 1
+#define ECLK_HZ  8000000UL
+#elif (CLOCK_PROFILE & 3) == 2
+#define ECLK_HZ 16000000UL
+#else
+#define ECLK_HZ 24000000UL
+#endif
+
+// ECLK = PLLCLK/2 = OSCCLK * (SYNR+1)/(REFDV+1), reference OSCCLK/(REFDV+1) = 4 MHz
+#define PLL_REFDV  (unsigned char)(OSC_HZ / 4000000UL - 1UL)
+#define PLL_SYNR   (unsigned char)(ECLK_HZ / 4000000UL - 1UL)
+
+// TIM clock: ECLK divided by 2^TIM_PRESCALER (TSCR2), the largest divider
+// that keeps the tick at 62.5 kHz or more (prescaler 7, /128, at most)
+#define TIM_PRESCALER  (ECLK_HZ >= 8000000UL ? 7 : ECLK_HZ >= 4000000UL ? 6 : 5)
+#define TIM_TICK_HZ    (ECLK_HZ >> TIM_PRESCALER)   // 62.5 kHz at 4 and 8 MHz
+
+// 32-bit intermediates: TONE_DHZ multiplies TIM_TICK_HZ by 16384, the
+// Farnsworth delay (TIM_TICK_HZ / 10) by up to 600 * 255 (setWPM() limits).
+// MORSE_UNIT and MORSE_DASH stay far below either bound.
+#if ECLK_HZ > 25000000UL || ECLK_HZ % 4000000UL != 0 || OSC_HZ % 4000000UL != 0
+#error "clock profile outside the HCS12 PLL range"
+#endif
+#if TIM_TICK_HZ > 262143UL
+#error "TIM_TICK_HZ too fast for TONE_DHZ"
+#endif
+#if TIM_TICK_HZ % 10UL != 0 || 600UL * 255UL > 0xFFFFFFFFUL / (TIM_TICK_HZ / 10UL)
+#error "TIM_TICK_HZ too fast for MORSE_FARNSWORTH_DELAY"
+#endif
+
+// Crystal fallback: setECLK_MODE() polls the PLL lock at most PLL_LOCK_POLLS
+// times, about 4 ms on the crystal bus. A PLL that hasn't locked by then is
+// left off, clockFallback is set and the bus stays at XTAL_ECLK_HZ = OSCCLK/2.
+// The TIM then runs from XTAL_TIM_PRESCALER, the divider closest to
+// TIM_TICK_HZ, and the PWM tone and SCI divisors follow TIM_PRESCALER_NOW.
+// That is exact when ECLK_HZ is a power-of-two multiple of OSCCLK/2. On the
+// 24 MHz profiles no divider gets there (TIM_TICK_HZ has a factor of 3), the
+// fallback tick is 4/3 of it: TIM_TICKS() takes the nominal ticks of the
+// tables, timings and tones to the ticks the TIM counts, as they are loaded
+// (loadDuration, the tones in loadCode/nextSymbol/keyerNext, the button,
+// lane and receiver constants). One division each, on that fallback only.
+// Deadlines for startTimer()/setAlarm() are timeNow() values: callers that
+// compute them from TIM_TICK_HZ go through TIM_TICKS() as well.
+#define XTAL_ECLK_HZ    (OSC_HZ / 2UL)
+#define XTAL_TICK_RATIO (XTAL_ECLK_HZ / TIM_TICK_HZ)
+#define XTAL_TIM_PRESCALER \
+          (XTAL_TICK_RATIO >= 91 ? 7 : XTAL_TICK_RATIO >= 45 ? 6 : XTAL_TICK_RATIO >= 23 ? 5 : \
+           XTAL_TICK_RATIO >= 11 ? 4 : XTAL_TICK_RATIO >= 6 ? 3 : XTAL_TICK_RATIO >= 3 ? 2 : \
+           XTAL_TICK_RATIO >= 2 ? 1 : 0)
+#define PLL_LOCK_POLLS  (unsigned int)(XTAL_ECLK_HZ / 2000UL)   // 8 cycles a poll
+#define TIM_PRESCALER_NOW  (clockFallback ? XTAL_TIM_PRESCALER : TIM_PRESCALER)
+#define XTAL_TICK_HZ    (XTAL_ECLK_HZ >> XTAL_TIM_PRESCALER)
+#if XTAL_TICK_HZ == TIM_TICK_HZ
+#define TIM_TICKS(n)    (n)
+#elif XTAL_TICK_HZ * 3UL == TIM_TICK_HZ * 4UL
+#define TIM_TICKS(n)    (clockFallback ? (n) + (n) / 3UL : (n))
+#else
+#error "no TIM_TICKS() for the crystal fallback of this CLOCK_PROFILE"
+#endif
+extern unsigned char clockFallback;
+
+/*** Morse timing from words per minute ***/
+// PARIS standard: a word is 50 units, so one unit (a dot) is 1.2 s / wpm.
+// Farnsworth: characters are sent at wpm, the letter and word gaps are
+// stretched so the overall rate is fwpm (ARRL formula, fwpm <= wpm).
+// Dash weight is the dash length in tenths of a unit, 30 = the standard 3:1.
+// All in integer ticks, 32 bits: anything over 65535 ticks (1.05 s) is sent
+// as a chain of compares (see toneDurationISR), so slow beacons work too.
+// The Farnsworth delay takes the /10 out of TIM_TICK_HZ first (exact, the
+// tick is a multiple of 10 Hz): TIM_TICK_HZ * 600 * wpm would overflow 32
+// bits at 45 WPM on the 24 MHz profile.
+#define MORSE_UNIT(wpm)  (TIM_TICK_HZ * 6UL / (5UL * (wpm)))
+#define MORSE_DASH(wpm, weight)  (MORSE_UNIT(wpm) * (weight) / 10UL)
+#define MORSE_FARNSWORTH_DELAY(wpm, fwpm) \
+          (TIM_TICK_HZ / 10UL * (600UL * (wpm) - 372UL * (fwpm)) / ((unsigned long)(fwpm) * (wpm)))
+#define MORSE_LETTER(wpm, fwpm)  (3UL * MORSE_FARNSWORTH_DELAY(wpm, fwpm) / 19UL)
+#define MORSE_WORD(wpm, fwpm)    (7UL * MORSE_FARNSWORTH_DELAY(wpm, fwpm) / 19UL)
+
+// Initializer of a struct MorseTiming
+#define MORSE_TIMING(wpm, fwpm, weight) \
+          { MORSE_UNIT(wpm), MORSE_DASH(wpm, weight), MORSE_UNIT(wpm), \
+            MORSE_LETTER(wpm, fwpm), MORSE_WORD(wpm, fwpm) }
+
+#ifndef MORSE_WPM
+#define MORSE_WPM  10
+#endif
+#ifndef MORSE_FARNSWORTH_WPM
+#define MORSE_FARNSWORTH_WPM  MORSE_WPM
+#endif
+#ifndef MORSE_DASH_WEIGHT
+#define MORSE_DASH_WEIGHT  30
+#endif
+#define MORSE_DEFAULT_TIMING  MORSE_TIMING(MORSE_WPM, MORSE_FARNSWORTH_WPM, MORSE_DASH_WEIGHT)
+
+/*** Tone pitch ***/
+// A tone is its half-period in TIM ticks as 16.16 fixed point, so any pitch
+// can be given, not only 62.5 kHz / 2n. SpeakerISR alternates n and n+1 tick
+// half-periods so that their mean is exact (TONE_DITHER 1), or rounds to
+// whole ticks (TONE_DITHER 0, the old behaviour). TONE_DHZ takes tenths of Hz.
+#define TONE_DHZ(dhz) \
+          ((TIM_TICK_HZ * 16384UL / (dhz)) * 20UL + (TIM_TICK_HZ * 16384UL % (dhz)) * 20UL / (dhz))
+#define TONE_HZ(hz)       TONE_DHZ(10UL * (hz))
+#define TONE_WHOLE(tone)  (unsigned int)((tone) >> 16)
+#define TONE_FRAC(tone)   (unsigned int)((tone) & 0xFFFFUL)
+#define TONE_ROUND(tone)  (unsigned int)(((tone) + 0x8000UL) >> 16)
+
+#ifndef TONE_DITHER
+#define TONE_DITHER 1
+#endif
+
+// Tone, tone duration (based on TIM_TICK_HZ) and led pattern 
+#define dot   TONE_HZ(1000)  // 1000 Hz tone
+#define dash  TONE_HZ(500)   // 500 Hz tone
 #define blank 1    // value need to be >0; 
 #define brk 0      // indicates end of code to transmit
-#define dot_duration  9000 // 145 msec
-#define dash_duration 4*dot_duration // 580 ms
+#define dot_duration   MORSE_UNIT(MORSE_WPM)                  // 120 ms at 10 WPM
+#define dash_duration  MORSE_DASH(MORSE_WPM, MORSE_DASH_WEIGHT) // 360 ms
 #define blank_duration dot_duration
 #define brk_duration dot_duration
+#define letter_duration MORSE_LETTER(MORSE_WPM, MORSE_FARNSWORTH_WPM)
+#define word_duration   MORSE_WORD(MORSE_WPM, MORSE_FARNSWORTH_WPM)
 #define dotLED   LED4
 #define dashLED  LED3
 
+// Scheduling of the next compare value
+//   1 - advance TC0/TC3 from their previous compare value: interrupt latency
+//       no longer adds to every half-period and symbol, nothing accumulates
+//   0 - legacy: next compare = TCNT + period, latency accumulates over a message
+#ifndef ABSOLUTE_SCHEDULING
+#define ABSOLUTE_SCHEDULING 1
+#endif
+
+// Tone generation backend
+//   TONE_BACKEND_OC  - TC3 toggles PT3, SpeakerISR runs on every half-period
+//   TONE_BACKEND_PWM - PWM channels 6/7 concatenated drive PP7, only
+//                      toneDurationISR runs; the speaker must be wired to PP7.
+//                      Pitch resolution is one bus cycle of period (0.25 Hz at
+//                      1 kHz), tones below 61 Hz do not fit the 16-bit period
+//                      (ECLK_HZ/65536: 367 Hz on the 24 MHz profiles)
+#define TONE_BACKEND_OC   0
+#define TONE_BACKEND_PWM  1
+#ifndef TONE_BACKEND
+#define TONE_BACKEND TONE_BACKEND_OC
+#endif
+
+#if TONE_BACKEND == TONE_BACKEND_PWM
+#define TONE_CHANNELS  TONEDURATION           // TIM channels used while sending
+#define PWM_TONE_PCKB  0x00                   // clock B = bus, 64 times finer than the TIM
+#define PWM_TONE_SHIFT (15 - TIM_PRESCALER_NOW)   // 16.16 half-period -> period in bus cycles
+#else
+#define TONE_CHANNELS  (SPEAKER | TONEDURATION)
+#endif
+
+/*** 32-bit timebase ***/
+// TCNT extended by the timer overflow interrupt: timeNow() counts TIM ticks
+// for 19 hours before it wraps. Longer than 16-bit waits are chained from
+// compares of at most TIME_CHUNK ticks on the same channel.
+#define TIME_CHUNK   0x8000U
+#define TIME_DUE(deadline, now)  ((long)((deadline) - (now)) <= 0)
+
+/*** Software timers ***/
+// Any number of struct Timer share the ALARM_TC compare. They sit in a
+// hierarchical wheel of TIMER_LEVELS levels of TIMER_SLOTS lists: level 0
+// slots are 2^TIMER_SHIFT ticks wide, each level up 16 times wider. A timer
+// goes in the level of the highest 4-bit digit in which its deadline (in
+// slots) differs from the wheel's clock, in the slot of that digit: linked
+// in and out in constant time, whatever the number of timers.
+// ALARM_TC is armed at the earliest deadline only, the one in the first
+// occupied slot of the lowest occupied level. When it is due, alarmISR
+// moves the timers of a higher level slot down to the levels below
+// (cascading, up to once per level for a timer), then runs every callback
+// that is due and re-arms the compare for the next deadline.
+// startTimer()/cancelTimer() are for main and the timer callbacks; an ISR
+// with the I bit set calls timerInsert()/timerRemove() itself. Callbacks
+// may run with the I bit clear (NEST_ALARM) and share main's writers of the
+// transmit queue and the event queue, which mask for it: anything else a
+// callback shares with main must be masked too, or left to main. initTIM()
+// restarts the timebase: start the timers after it.
+#define TIMER_SHIFT   8     // level 0 slot: 256 ticks, 4.1 ms at 62.5 kHz
+#define TIMER_BITS    4
+#define TIMER_SLOTS   (1 << TIMER_BITS)
+#define TIMER_LEVELS  ((32 - TIMER_SHIFT + TIMER_BITS - 1) / TIMER_BITS)  // all 32 bits
+#define TIMER_CLOCK_MASK  (0xFFFFFFFFUL >> TIMER_SHIFT)  // the clock counts slots
+#define TIMER_LEAD    2     // ticks: ALARM_TC is armed at least this far ahead of TCNT
+
+struct Timer
+  {
+  struct Timer *next;        // in its wheel slot
+  struct Timer **prev;       // the pointer to it, 0 while not started
+  unsigned long deadline;    // timeNow() value
+  void (*callback)(struct Timer *timer);  // runs in alarmISR at the deadline
+  unsigned char slot;        // wheel slot, level * TIMER_SLOTS + slot of the level
+  };
+
+/*** Interrupt priority and nesting ***/
+// The TIM vectors are served TC0 first, then TC1..TC7, the overflow last.
+// HPRIO moves one of them ahead of all the others: it takes the low byte of
+// the vector address. The speaker has the tightest deadline (its next
+// compare must be written before TCNT gets there), so TC3 goes first.
+// HPRIO_RESET keeps the fixed order. So does the TIM_FLAG_RMW comparison
+// build: with TC3 first, its TFLG1 |= would clear a TC0 flag pending at the
+// same compare and stall the message.
+#define HPRIO_TIMCH0  0xEE        // Vtimch0 at 0xFFEE, ... Vtimch7 at 0xFFE0
+#define HPRIO_TIMCH3  0xE8
+#define HPRIO_RESET   0xF2        // IRQ, the reset value
+#ifndef ISR_HPRIO
+#if TIM_FLAG_RMW
+#define ISR_HPRIO  HPRIO_RESET
+#else
+#define ISR_HPRIO  HPRIO_TIMCH3
+#endif
+#endif
+
+// ISRs with a long part re-enable interrupts for it once their own flag is
+// cleared, so SpeakerISR can preempt them. ISR_NEST selects which:
+//   NEST_TONE  - toneDurationISR while it decodes the next element
+//   NEST_ALARM - alarmISR while the timer callbacks run
+// Neither is reentered: its flag is clear and its compare is far ahead.
+// 0 is the old behaviour, every ISR runs to the end with interrupts masked.
+#define NEST_TONE   0x01
+#define NEST_ALARM  0x02
+#ifndef ISR_NEST
+#define ISR_NEST  (NEST_TONE | NEST_ALARM)
+#endif
+#define ISR_NEST_OPEN(isr)   do { if (ISR_NEST & (isr)) EnableInterrupts; } while (0)
+#define ISR_NEST_CLOSE(isr)  do { if (ISR_NEST & (isr)) DisableInterrupts; } while (0)
+
+// Code that main, a timer callback (I bit clear under NEST_ALARM) and an ISR
+// may all call masks interrupts with MASK_INTERRUPTS and gives the caller
+// back its own I bit with RESTORE_INTERRUPTS, clear or set. SAVE_CCR is
+// CodeWarrior inline assembly; the simulator's hidef.h supplies its own.
+#define CCR_I  0x10
+#ifndef SAVE_CCR
+#define SAVE_CCR(saved)  {__asm TFR CCR,B; __asm STAB saved;}
+#endif
+#define MASK_INTERRUPTS(saved)     do { SAVE_CCR(saved); DisableInterrupts; } while (0)
+#define RESTORE_INTERRUPTS(saved)  do { if (!((saved) & CCR_I)) EnableInterrupts; } while (0)
+
+/*** ISR cycle budget instrumentation ***/
+// ISR_PROFILE 1 timestamps entry and exit of every ISR and keeps per-vector
+// statistics in isrStats[], a fixed RAM table a debugger can read over BDM
+// (or print it over SCI0 with dumpIsrStats()). ISR_PROFILE 0 expands the
+// hooks to nothing: no code, no RAM.
+//  - Execution time: bus cycles from ISR_ENTER to ISR_EXIT, counted by the
+//    ECT modulus down-counter free running at ECLK (wraps every 16.4 ms at
+//    4 MHz). The 9-cycle stacking and the RTI are not included; time spent
+//    in ISRs nested into a NEST_ ISR is.
+//  - Entry latency: TCNT at ISR_ENTER minus the TCx value that fired (the
+//    compare, or the captured edge of a button), in TIM ticks of 16 us.
+//    Stacking, higher-priority ISRs and masked sections all show up here.
+#ifndef ISR_PROFILE
+#define ISR_PROFILE 0
+#endif
+
+#define ISR_ID_TONE     0    // ids are the TIM channel numbers, 8 for the overflow
+#define ISR_ID_ALARM    1
+#define ISR_ID_RX       2
+#define ISR_ID_SPEAKER  3
+#define ISR_ID_SW1      4
+#define ISR_ID_SW2      5
+#define ISR_ID_SW3      6
+#define ISR_ID_SW4      7
+#define ISR_ID_TOF      8
+#define ISR_ID_COUNT    9
+
+#if ISR_PROFILE
+struct IsrStats
+  {
+  unsigned long calls;
+  unsigned int  minCycles, maxCycles;
+  unsigned long sumCycles;              // mean = sumCycles / calls
+  unsigned int  minLatency, maxLatency; // TIM ticks
+  unsigned long sumLatency;
+  };
+extern struct IsrStats isrStats[ISR_ID_COUNT];
+extern unsigned int isrEntry[ISR_ID_COUNT];   // MCCNT at entry of the ISR in service
+extern unsigned int isrLate[ISR_ID_COUNT];    // its entry latency
+#define ISR_ENTER(id, fired)  (isrEntry[id] = MCCNT, isrLate[id] = TCNT - (fired))
+#define ISR_EXIT(id)          isrRecord(id)
+#else
+#define ISR_ENTER(id, fired)  ((void)0)
+#define ISR_EXIT(id)          ((void)0)
+#endif
+
 // Define data structure of Morse code
+// Table durations are 16 bits; streams, text and pauses may be longer.
 struct MorseCode
   {
-  unsigned int tone;
+  unsigned long tone;        // 16.16 half-period, blank or brk
   unsigned int duration;
   unsigned char leds;
   };
 
+// Morse tables are const and stay in flash, nothing is copied down to RAM
+//   0 - tables in ROM_VAR (non-banked flash), walked with near pointers
+//   1 - tables in the MORSE_ROM segment of the paged PAGE_2x flash (Project.prm),
+//       walked with __far pointers through the datapage.c runtime. Use this
+//       once a message library no longer fits the 16K of non-banked flash.
+#ifndef MORSE_TABLES_PAGED
+#define MORSE_TABLES_PAGED 0
+#endif
+
+#if MORSE_TABLES_PAGED
+#define MORSE_FAR  __far
+#else
+#define MORSE_FAR
+#endif
+
+// Reads of a table in the decoders. A __far access is a _LOAD_FAR_8..32 call
+// (datapage.c) that looks the page register up again for every field. The
+// tables are known to be behind PPAGE, so the decoders map the table's page
+// once and read it through a near pointer into the 0x8000-0xBFFF window:
+//   MORSE_MAP(p, saved)    save PPAGE in saved, map the page of p
+//   MORSE_NEAR(type, p)    p as a near pointer, valid while mapped
+//   MORSE_UNMAP(saved)     restore PPAGE
+// Only from non-paged code (HOT_ROM), as the window is switched under it.
+// A far data pointer holds the page in bits 23:16, as in 0x208000; a host
+// build with flat pointers (Sim/hidef.h) defines MORSE_PAGE_OF and
+// MORSE_WINDOW itself. Near tables keep saved at 0, nothing is read unset.
+#ifndef MORSE_PAGE_OF
+#define MORSE_PAGE_OF(p)       ((unsigned char)((unsigned long)(p) >> 16))
+#define MORSE_WINDOW(type, p)  ((type)(unsigned int)(unsigned long)(p))
+#endif
+#if MORSE_TABLES_PAGED
+#define MORSE_MAP(p, saved)  ((saved) = PPAGE, PPAGE = MORSE_PAGE_OF(p))
+#define MORSE_NEAR(type, p)  MORSE_WINDOW(type, p)
+#define MORSE_UNMAP(saved)   (PPAGE = (saved))
+#else
+#define MORSE_MAP(p, saved)  ((saved) = 0)
+#define MORSE_NEAR(type, p)  ((type)(p))
+#define MORSE_UNMAP(saved)   ((void)(saved))
+#endif
+
+typedef const struct MorseCode *MORSE_FAR MorseCodePtr;
+
+/*** Packed Morse symbol streams ***/
+// 2-bit symbols, four per byte, first symbol in bits 7:6. Every dot and dash is
+// followed by the gap between elements, unless the next symbol turns it into a
+// letter or word gap. SOS as one stream is 9 symbols = 3 bytes + header.
+#define SYM_DOT     0
+#define SYM_DASH    1
+#define SYM_LETTER  2    // letter gap instead of the gap between elements
+#define SYM_WORD    3    // word gap instead of the gap between elements
+#define MORSE_PACK(s0, s1, s2, s3) \
+          (unsigned char)(((s0) << 6) | ((s1) << 4) | ((s2) << 2) | (s3))
+
+// Element and gap lengths in TIM ticks
+struct MorseTiming
+  {
+  unsigned long dotTicks;
+  unsigned long dashTicks;
+  unsigned long gapTicks;     // between the elements of one character
+  unsigned long letterTicks;  // between letters
+  unsigned long wordTicks;    // between words
+  };
+
+// Tones, LED patterns and timing shared by all elements of a message
+struct MorseFormat
+  {
+  unsigned long dotTone;     // half-periods, as the tone of struct MorseCode
+  unsigned long dashTone;
+  unsigned char dotLEDs;
+  unsigned char dashLEDs;
+  struct MorseTiming timing;
+  };
+
+typedef const struct MorseFormat *MORSE_FAR MorseFormatPtr;
+
+// Header of a packed stream: everything that used to be repeated per element
+struct MorseStream
+  {
+  struct MorseFormat format;
+  unsigned int  length;      // number of symbols
+  const unsigned char *MORSE_FAR symbols;
+  };
+
+typedef const struct MorseStream *MORSE_FAR MorseStreamPtr;
+
+// Timing presets, built at compile time; setTimingPreset() switches to one
+#define PRESET_10WPM     0
+#define PRESET_13WPM     1
+#define PRESET_15WPM     2
+#define PRESET_20WPM     3
+#define PRESET_25WPM     4
+#define PRESET_18_13WPM  5    // 18 WPM characters, 13 WPM Farnsworth spacing
+#define PRESET_20_13WPM  6
+#define PRESET_COUNT     7
+
+/*** Runtime ASCII encoder ***/
+// Text is encoded one character at a time into a small symbol FIFO, which
+// toneDurationISR drains. pumpText() refills it from main; the FIFO holds at
+// least one whole character (7 elements + gap for '$') ahead of the ISR.
+#define TEXT_FIFO_SIZE  16   // power of 2
+#define TEXT_FIFO_MASK  (TEXT_FIFO_SIZE - 1)
+#define TEXT_CHAR_MAX   8    // symbols of the longest character incl. its gap
+extern const unsigned char MORSE_ASCII[64]; // ASCII 0x20..0x5F to Morse (initLAB1.c)
+
+/*** Straight key receiver ***/
+// startKey() turns one of the buttons into a straight key. Its capture ISR
+// debounces both edges as for the unlock (buttonEdge) and queues their edge
+// times in keyEdges[] - a fixed few dozen cycles whatever the key does, so
+// the tone ISRs keep their timing. pumpKey() (main loop) measures the marks
+// and spaces, classifies them, walks MORSE_TREE[] and puts the characters
+// in keyText[], read back with keyRead().
+// Speed: the unit is the mean length of the one-unit marks and spaces among
+// the last KEY_UNIT_WINDOW, those within 1.5 times the shortest. Every
+// character of two or more elements has a one-unit element, so the estimate
+// follows the operator up or down within a character or two. A space of
+// 2 units or more ends the character, of 5 units or more the word. The
+// marks are classified once the character has ended, with the unit its own
+// elements gave: 2 units or more is a dash.
+#define KEY_EDGE_SIZE    8    // power of 2
+#define KEY_EDGE_MASK    (KEY_EDGE_SIZE - 1)
+#define KEY_TEXT_SIZE    32   // power of 2
+#define KEY_TEXT_MASK    (KEY_TEXT_SIZE - 1)
+#define KEY_UNIT_WINDOW  8
+#define KEY_MARKS_MAX    6    // elements of the longest character in MORSE_TREE[]
+#define KEY_TREE_SIZE    128  // MORSE_TREE[], indices of up to 6 elements
+#define KEY_UNKNOWN      '#'  // has no Morse code: stands for one that isn't known
+
+struct KeyEdge
+  {
+  unsigned long at;          // edge time, timeNow() ticks
+  unsigned char down;        // 1 key pressed (a mark starts), 0 released
+  };
+
+/*** Iambic keyer ***/
+// startKeyer() turns two buttons into dit and dah paddles. A paddle press
+// while nothing is sent starts the keyer from the capture ISR itself
+// (buttonEdge): the first speaker toggle is KEYER_LEAD ticks after sendCode(),
+// so the sidetone starts some 100 us after the edge, not a half-period or a
+// main loop pass later. The keyer is then one more element source of
+// toneDurationISR (SOURCE_KEYER): each dit or dah is followed by its gap,
+// and at the end of the gap the paddles and their memories decide the next
+// element - a held paddle repeats, a squeeze alternates, none stops.
+// Memory: a press during an element or gap is remembered until sent, so a
+// dit tapped during a dah still follows it.
+// KEYER_IAMBIC_B also sends one more alternate element when a squeeze is
+// let go; KEYER_IAMBIC_A stops after the element being sent.
+// Speed, sidetone and LEDs are the format's (dot and dash tone alike, say);
+// a setTiming()/setWPM() override applies as for a stream.
+#define KEYER_IAMBIC_A   0
+#define KEYER_IAMBIC_B   1
+#define KEYER_LEAD       2    // ticks from the start of a mark to its first toggle
+
+/*** Audio receiver ***/
+// startReceiver() decodes Morse from a tone on ATD0 channel RX_ATD_CHANNEL,
+// biased at mid-scale. rxSampleISR runs on every RX_TC compare, RX_SAMPLE_TICKS
+// apart (absolute, as the tone): it reads the conversion the last compare
+// started, starts the next one and runs one Goertzel step on it (rxFilter:
+// one 16x16 multiply). Every RX_BLOCK samples the filter state goes to
+// rxBlocks[] and the filter starts over. pumpReceiver() (main loop) turns
+// each block into the magnitude of the tone and compares it with a
+// threshold 5/8 of the way (3/8 going back down) from the noise floor to
+// the peak level, both tracked: the peak at once upwards and decaying
+// towards the floor, the floor over the blocks below the threshold. Below
+// RX_SQUELCH times the floor the peak keys nothing. A key-down/key-up edge
+// takes RX_HOLD_BLOCKS blocks in a row; it goes to keyEdges[] at the end
+// time of the first of them, and pumpKey() decodes the edges as those of a
+// straight key.
+// RX_COEFF, 2 cos(2 pi f/fs) in Q14 at the actual sample rate, comes from a
+// Taylor series in floating constants that the compiler folds; no float
+// code is generated. The bin is RX_SAMPLE_HZ/RX_BLOCK = 100 Hz wide.
+// On the 24 MHz crystal fallback rxSampleTicks is TIM_TICKS(RX_SAMPLE_TICKS):
+// the sample rate, and with it the bin, is within 1.1% of the PLL one.
+#ifndef RX_TONE_HZ
+#define RX_TONE_HZ       700
+#endif
+#ifndef RX_BLOCK
+#define RX_BLOCK         40   // samples per Goertzel block, 10 ms
+#endif
+#define RX_ATD_CHANNEL   0
+#define RX_SAMPLE_HZ     4000UL
+#define RX_SAMPLE_TICKS  (unsigned int)((TIM_TICK_HZ + RX_SAMPLE_HZ / 2) / RX_SAMPLE_HZ)
+#define RX_BLOCK_TICKS   ((unsigned long)RX_BLOCK * rxSampleTicks)
+#define RX_BLOCK_FIFO    8    // power of 2
+#define RX_BLOCK_MASK    (RX_BLOCK_FIFO - 1)
+#define RX_MIN_MAG       (RX_BLOCK / 2)  // peak over floor of a tone, 1 LSB amplitude
+#define RX_PEAK_DECAY    6    // peak falls 1/64 of the way to the floor each block
+#define RX_SQUELCH       3    // peak over floor, magnitudes, for a tone to count (~10 dB)
+#define RX_HOLD_BLOCKS   2    // blocks in a row for a key edge
+#define RX_ATD_PRS       (unsigned char)(((clockFallback ? XTAL_ECLK_HZ : ECLK_HZ) + 3999999UL) / 4000000UL - 1)
+#define RX_W             (6.283185307 * RX_TONE_HZ * RX_SAMPLE_TICKS / TIM_TICK_HZ)
+#define RX_W2            (RX_W * RX_W)
+#define RX_COS           (1 - RX_W2 / 2 * (1 - RX_W2 / 12 * (1 - RX_W2 / 30 * (1 - RX_W2 / 56 * \
+                           (1 - RX_W2 / 90 * (1 - RX_W2 / 132))))))
+#define RX_COEFF         (int)(RX_COS * 32768.0 + (RX_COS < 0 ? -0.5 : 0.5))
+
+struct RxBlock
+  {
+  int s1, s2;                 // Goertzel state after the last sample of the block
+  unsigned int number;        // blocks since startReceiver(), low half
+  };
+
+/*** LED lanes ***/
+// startLane() sends a text on one LED alone, at its own speed: up to
+// LANE_COUNT messages side by side, lane n on LED1 >> n. They take no TIM
+// channel of their own. One software timer, laneTimer, is armed at the
+// earliest transition of all the lanes; its callback (laneStep) moves every
+// lane that is due on to its next element or gap, writes the pattern of
+// all four to PTM in one store and re-arms for the next earliest one. A
+// lane's transitions follow from its own previous one, not from when the
+// callback ran, so lateness doesn't add up over a message. No sidetone.
+// The LEDs are the lanes' until lanesBusy() is 0: startLane() refuses while
+// code is being sent, and sendCode() and the unlock sequence must wait.
+#define LANE_COUNT  4
+#define LANE_LEAD   16   // ticks from startLane() to the lane's first mark
+
+struct Lane
+  {
+  const char   *text;        // next character, 0 once the lane has ended
+  unsigned char code;        // MORSE_ASCII[] of the character being sent
+  unsigned char elements;    // and its elements not started yet
+  unsigned char on;          // an element is being sent, LED lit
+  unsigned long next;        // timeNow() of the lane's next transition
+  struct MorseTiming timing;
+  };
+
+/*** Transmit queue ***/
+// Messages queued while one is being sent follow it without a break:
+// toneDurationISR starts the next one from the compare that ended the last
+// element of the previous one. The ISR is the only writer of the tail and
+// never masks. Main and the alarm callbacks both write the head, so
+// queueMessage() and sendQueued() mask interrupts: a callback can't land in
+// the middle of main's copy, or start the queue under main.
+#define MSG_TABLE    0    // struct MorseCode table ending in brk
+#define MSG_STREAM   1    // packed symbol stream
+#define MSG_TEXT     2    // C string through the ASCII encoder
+#define MSG_SOURCE   3    // character generator through the ASCII encoder
+#define MSG_PAUSE    4    // silence, e.g. between repeats of a beacon
+#define MSG_QUEUE_SIZE  8    // power of 2
+#define MSG_QUEUE_MASK  (MSG_QUEUE_SIZE - 1)
+
+struct MorseMessage
+  {
+  unsigned char  kind;       // MSG_TABLE..MSG_SOURCE
+  MorseCodePtr   code;       // MSG_TABLE
+  MorseStreamPtr stream;     // MSG_STREAM
+  MorseFormatPtr format;     // MSG_TEXT, MSG_SOURCE
+  const char    *text;       // MSG_TEXT
+  char (*source)(void);      // MSG_SOURCE
+  unsigned long  ticks;      // MSG_PAUSE
+  };
+
+/*** Event loop ***/
+// Main sleeps in waitEvent() until an ISR has work for it: the ISR posts
+// the event (postEvent) and returns, main does the work. Each event is
+// queued once at most until waitEvent() hands it out, so the queue can't
+// fill and a post is a few stores. The ISRs are the only writers of the
+// head, waitEvent() of the tail, and the posts are serialized by the I bit
+// (queueEvent() sets it for main and the timer callbacks).
+// Idle is WAI: the CPU clock stops with the registers already stacked, the
+// TIM runs on and its interrupt wakes the CPU. TSWAI (TSCR1) stays clear
+// and STOP isn't used: either one stops the TIM, and every wake source here
+// is a TIM channel (the buttons are PTT input captures, not key wakeups),
+// so nothing but a reset would wake the CPU again.
+#define EVENT_NONE      0
+#define EVENT_TEXT      1    // the text FIFO has room for a character: pumpText()
+#define EVENT_KEY       2    // a straight key edge, or its character is due: pumpKey()
+#define EVENT_RX        3    // a sampled block is ready: pumpReceiver(), pumpKey()
+#define EVENT_UNLOCKED  4    // the unlock sequence is complete
+#define EVENT_COUNT     5
+#define EVENT_QUEUE_SIZE  8  // power of 2, at least EVENT_COUNT
+#define EVENT_QUEUE_MASK  (EVENT_QUEUE_SIZE - 1)
+
+// main.c: 1 - event loop, 0 - the pumps polled in a nop loop, for comparison
+#ifndef EVENT_LOOP
+#define EVENT_LOOP  1
+#endif
+
+// WAI with no wakeup lost: the CPU12 takes no interrupt in the instruction
+// after CLI, so one that comes once the queue was found empty wakes the WAI
+#define IDLE_WAIT()  do { asm("cli"); asm("wai"); } while (0)
+
 /**** Function DECLARATIONS ****/
 void setECLK_MODE(void);      // to set ECLK speed and mode of operation
 void initTIM(void);           // to prepare Enhanced Capture Timer (TIM: Timer Interface Module)
 void initPTM(void);           // to set I/O lines for Port M connected to LEDs
 void setLEDs(unsigned char);  // to set pattern on LEDs
-void initCode(struct MorseCode *code); // to initialize hardware to send code 
-void sendCode(void);                   // to send code
-void stopCode(void);                   // to stop sending code
+void initCode(MorseCodePtr code);      // to initialize hardware to send code 
+void initStream(MorseStreamPtr stream); // same, for a packed symbol stream
+void initText(MorseFormatPtr format, const char *text);        // same, for a C string
+void initTextSource(MorseFormatPtr format, char (*next)(void)); // same, for a character generator
+unsigned char queueMessage(const struct MorseMessage *msg); // to send after the current message
+unsigned char queueCode(MorseCodePtr code);                  // same, for a table
+unsigned char queueStream(MorseStreamPtr stream);            // same, for a packed stream
+unsigned char queueText(MorseFormatPtr format, const char *text); // same, for a C string
+unsigned char queuePause(unsigned long ticks);               // same, for silence
+unsigned char codeBusy(void);          // 1 while code is being sent
+void setTiming(const struct MorseTiming *timing); // to override stream/text timing, 0 = per message
+void setTimingPreset(unsigned char preset);       // same, with one of the PRESET_ tables
+unsigned char setWPM(unsigned char wpm, unsigned char fwpm, unsigned char dashWeight); // same, computed
+void setAlarm(unsigned long deadline, void (*callback)(void)); // to call back at a timeNow() value
+void cancelAlarm(void);
+void startTimer(struct Timer *timer, unsigned long deadline, void (*callback)(struct Timer *timer));
+void cancelTimer(struct Timer *timer); // (re)start and stop a software timer, from main or a callback
+void startKey(unsigned char button);   // to decode the button (BUT_CHx_M) as a straight key
+void stopKey(void);                    // to give it back to the unlock sequence
+void pumpKey(void);                    // to decode the key's edges, from the main loop
+char keyRead(void);                    // next decoded character, 0 if none
+unsigned char keyWPM(void);            // the key's speed estimate
+void startKeyer(MorseFormatPtr format, unsigned char dit, unsigned char dah, unsigned char mode); // paddles (BUT_CHx_M)
+void stopKeyer(void);                  // to give the paddles back to the unlock sequence
+void startReceiver(void);              // to decode the tone on ATD0 through pumpKey(), replaces a straight key
+void stopReceiver(void);
+void pumpReceiver(void);               // to detect the tone in the sampled blocks, from the main loop
+unsigned long rxPower(const struct RxBlock *block); // squared magnitude of the tone in a block
+unsigned char startLane(unsigned char lane, const char *text, unsigned char wpm); // text on LED1 >> lane
+void stopLanes(void);
+unsigned char lanesBusy(void);         // LEDs of the lanes still sending
+unsigned char waitEvent(void);         // next EVENT_, in WAI until there is one
+void queueEvent(unsigned char event);  // postEvent() from main or a timer callback
 
 // Added
 void initPTT(void);
+void initATD(void);                    // to set ATD0 up for 8-bit single conversions
+void initSCI(void);                    // to set SCI0 up for 9600 8N1 output
+void sciPutChar(char c);               // to send a character on SCI0, polled
+#if ISR_PROFILE
+void resetIsrStats(void);
+void dumpIsrStats(void (*put)(char));  // to print isrStats[], e.g. dumpIsrStats(sciPutChar)
+#endif
+
+/*** Hot code ***/
+// The ISRs and everything they call go in HOT_ROM, a near segment in
+// non-paged flash (Project.prm): JSR/RTS, 9 cycles a call, instead of the
+// CALL/RTC and PPAGE switch of paged code, 13. Init and setup code stays
+// paged in DEFAULT_ROM. Callers must see a near function declared near, so
+// these prototypes sit inside the same pragma as the definitions.
+// Function pointers (alarm callbacks, text sources) are far: leave their
+// targets in paged code.
+#pragma CODE_SEG __NEAR_SEG HOT_ROM
+void sendCode(void);                   // to send code
+void stopCode(void);                   // to stop sending code
+void sendQueued(void);                 // to start the queue if nothing is being sent
+void pumpText(void);                   // to keep the text encoder ahead of the ISR
+unsigned long timeNow(void);           // 32-bit TIM tick count, from main or an ISR
+void timerInsert(struct Timer *timer, unsigned long deadline, void (*callback)(struct Timer *timer));
+void timerRemove(struct Timer *timer); // startTimer()/cancelTimer() with the I bit set
+unsigned char rxFilter(int x);         // one Goertzel step, 1 when it completed a block
+void postEvent(unsigned char event);   // for main's waitEvent(), with the I bit set
+#if TONE_BACKEND == TONE_BACKEND_PWM
+void setTone(unsigned long tone);      // to start/stop the PWM tone
+#endif
+#if ISR_PROFILE
+void isrRecord(unsigned char id);      // ISR_EXIT: to add the ISR's run to isrStats[]
+#endif
+#pragma CODE_SEG DEFAULT
 
 
 /*** Additional code/constants for buttons ***/ 
 // As you see fit // 
 
+// Unlock sequence: once a message ends, stopCode() arms all four buttons and
+// the presses walk UNLOCK_SEQUENCE[] (initLAB1.c), one row per step: the
+// button that advances it and the LEDs shown once it has. The last row
+// unlocks and disarms the buttons. A wrong press starts over, counting
+// itself if it is the first button of the sequence, and a sequence left
+// unfinished for UNLOCK_TIMEOUT_MS is reset by a software timer. Both reset
+// to UNLOCK_LOCKED_LEDS.
+// Debounce: the buttons capture both edges and SWx_ISR compares the
+// captured edge times, no waiting. A change of the pin against the button's
+// debounced state is taken only BUTTON_DEBOUNCE_MS after its last change.
+// An edge in between starts a software timer for the end of that window,
+// and the pin is taken as it is then: a tap shorter than the window still
+// gets its release. (The ECT delay counter only filters IC0-3 and 1024 bus
+// cycles at most, far below contact bounce.)
+struct UnlockStep
+  {
+  unsigned char button;      // BUT_CHx_M
+  unsigned char leds;        // LED pattern after the press
+  };
+
+#ifndef BUTTON_DEBOUNCE_MS
+#define BUTTON_DEBOUNCE_MS  10
+#endif
+#ifndef UNLOCK_TIMEOUT_MS
+#define UNLOCK_TIMEOUT_MS   5000
+#endif
+#define BUTTON_DEBOUNCE_TICKS  TIM_TICKS(TIM_TICK_HZ * BUTTON_DEBOUNCE_MS / 1000UL)
+#define UNLOCK_TIMEOUT_TICKS   TIM_TICKS(TIM_TICK_HZ * UNLOCK_TIMEOUT_MS / 1000UL)
+#define UNLOCK_LOCKED_LEDS     (unsigned char)~LEDSOFF
+#define BUTTON_EDGES           0xFF   // TCTL3: both edges on TC7:4
+
+extern const struct UnlockStep UNLOCK_SEQUENCE[];
+extern const unsigned char UNLOCK_STEPS;
+
+
+
 
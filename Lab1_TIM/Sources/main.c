@@ -11,9 +11,24 @@
 #include <stdio.h>
 
 
+// 1 - send the packed SOS_STREAM, 0 - send the SOS table
+#ifndef SEND_PACKED_SOS
+#define SEND_PACKED_SOS 1
+#endif
+
 // MorseCode type is defined in initLAB1.h
-// Declare Morse Code to be transmitted 
-struct MorseCode SOS[] =  
+// Declare Morse Code to be transmitted. It is const so it stays in flash
+// (ROM_VAR, or the paged MORSE_ROM segment) instead of being copied to RAM.
+#if MORSE_TABLES_PAGED
+#pragma CONST_SEG __PPAGE_SEG MORSE_ROM
+#endif
+#if !SEND_PACKED_SOS
+// MorseCode durations are 16-bit ticks: a 360 ms dash fits up to a 182 kHz
+// tick, so not at 10 WPM on the 24 MHz clock profiles (187.5 kHz)
+#if dash_duration > 0xFFFFUL
+#error "SOS table durations overflow 16 bits at this TIM_TICK_HZ: send SOS_STREAM"
+#endif
+const struct MorseCode SOS[] =  
   {
     { dot, dot_duration, LED4 } ,
     { blank, blank_duration, LEDSOFF } ,
@@ -35,6 +50,25 @@ struct MorseCode SOS[] =
     { blank, blank_duration, LEDSOFF } , 
     { brk, brk_duration, LEDSOFF }        //End of code
   };
+#endif
+
+// The same SOS as a packed stream: 9 symbols in 3 bytes plus a 20-byte header.
+// The letters run together because SOS is sent as a single prosign.
+const unsigned char SOS_SYMBOLS[] =
+  {
+    MORSE_PACK(SYM_DOT,  SYM_DOT,  SYM_DOT,  SYM_DASH),
+    MORSE_PACK(SYM_DASH, SYM_DASH, SYM_DOT,  SYM_DOT),
+    MORSE_PACK(SYM_DOT,  0,        0,        0)
+  };
+
+const struct MorseStream SOS_STREAM =
+  {
+    { dot, dash, LED4, LED34, MORSE_DEFAULT_TIMING },
+    9, SOS_SYMBOLS
+  };
+#if MORSE_TABLES_PAGED
+#pragma CONST_SEG DEFAULT
+#endif
 
 void main(void) 
 {
@@ -44,12 +78,31 @@ void main(void)
  initTIM();           // prepare Enhanced Capture Timer (TIM: Timer Interface Module)
  initPTM();           // set I/O lines for Port M connected to LEDs
  initPTT();           // set I/O lines for PTT which connects switches and speaker
+#if SEND_PACKED_SOS
+ initStream(&SOS_STREAM); // prepare channels to send code
+#else
  initCode(SOS);       // prepare channels to send code
+#endif
  EnableInterrupts;    // need to enable interrupts, else hardware will not be served
  sendCode();          // transmit SOS code
    
+#if EVENT_LOOP
+ for(;;)
+   {
+     switch (waitEvent())   // sleep in WAI until an ISR has work for main
+       {
+       case EVENT_TEXT:
+         pumpText();        // keep the text encoder ahead, if text is being sent
+         break;
+       default:
+         break;
+       }
+   }
+#else
  for(;;)
    {
+     pumpText();   // keep the text encoder ahead, if text is being sent
      asm("nop");   // loop and wait for interrupt
    }
+#endif
 }